@@ -0,0 +1,104 @@
+// Host stand-in for argtable3, covering positional integer arguments only.
+
+#include <argtable3/argtable3.h>
+
+#include <cstdlib>
+#include <cstring>
+
+struct arg_int* arg_int1(const char*, const char*, const char* datatype, const char* glossary)
+{
+    auto a = new arg_int;
+    a->hdr.flag = ARG_HASVALUE;
+    a->hdr.datatype = datatype;
+    a->hdr.glossary = glossary;
+    a->hdr.mincount = 1;
+    a->hdr.maxcount = 1;
+    a->count = 0;
+    a->ival = new int[1]();
+    return a;
+}
+
+struct arg_end* arg_end(int maxcount)
+{
+    auto e = new struct arg_end;
+    e->hdr.flag = ARG_TERMINATOR;
+    e->hdr.datatype = nullptr;
+    e->hdr.glossary = nullptr;
+    e->hdr.mincount = 1;
+    e->hdr.maxcount = maxcount;
+    e->count = 0;
+    e->error = new int[maxcount]();
+    e->argval = new const char*[maxcount]();
+    return e;
+}
+
+static void add_error(struct arg_end* end, int error, const char* argval)
+{
+    if (end->count < end->hdr.maxcount)
+    {
+        end->error[end->count] = error;
+        end->argval[end->count] = argval;
+        ++end->count;
+    }
+}
+
+enum
+{
+    ARG_ERR_MINCOUNT = 1,
+    ARG_ERR_MAXCOUNT,
+    ARG_ERR_BADINT
+};
+
+int arg_parse(int argc, char** argv, void** argtable)
+{
+    int n = 0;
+    while (!(((struct arg_hdr*) argtable[n])->flag & ARG_TERMINATOR))
+        ++n;
+    auto end = (struct arg_end*) argtable[n];
+    end->count = 0;
+
+    int arg = 1;
+    for (int i = 0; i < n; ++i)
+    {
+        auto a = (struct arg_int*) argtable[i];
+        a->count = 0;
+        if (arg >= argc)
+        {
+            add_error(end, ARG_ERR_MINCOUNT, a->hdr.datatype);
+            continue;
+        }
+        // As in argtable3, anything starting with '-' is taken to be an option
+        char* endp = nullptr;
+        const long v = strtol(argv[arg], &endp, 0);
+        if (argv[arg][0] == '-' || *endp != 0)
+            add_error(end, ARG_ERR_BADINT, argv[arg]);
+        else
+        {
+            a->ival[0] = (int) v;
+            a->count = 1;
+        }
+        ++arg;
+    }
+    for (; arg < argc; ++arg)
+        add_error(end, ARG_ERR_MAXCOUNT, argv[arg]);
+    return end->count;
+}
+
+void arg_print_errors(FILE* fp, struct arg_end* end, const char* progname)
+{
+    for (int i = 0; i < end->count; ++i)
+    {
+        switch (end->error[i])
+        {
+        case ARG_ERR_MINCOUNT:
+            fprintf(fp, "%s: missing option %s\n", progname, end->argval[i]);
+            break;
+        case ARG_ERR_MAXCOUNT:
+            fprintf(fp, "%s: unexpected argument \"%s\"\n", progname, end->argval[i]);
+            break;
+        case ARG_ERR_BADINT:
+            fprintf(fp, "%s: invalid argument \"%s\"\n", progname, end->argval[i]);
+            break;
+        }
+    }
+}
@@ -0,0 +1,173 @@
+// Compares the lock-free Encoder against the queue-based design it replaced:
+// the cost of poll() and its correctness while the counter overflows rapidly.
+//
+// Output, one line per design:
+//   encoder/<design> read_ns=<ns per poll> checks=<n> errors=<n> max_error=<pulses> final_error=<pulses>
+//
+// 'errors' counts polls outside the range of true positions during the call.
+
+#include "plant.h"
+#include "sim.h"
+
+#include "encoder.h"
+
+#include <freertos/queue.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+constexpr int16_t H_LIM = 1000;
+constexpr int16_t L_LIM = -1000;
+
+/// The design before the ISR kept the position: limit events are queued by
+/// the ISR and poll() applies at most one of them per call.
+class QueueEncoder
+{
+public:
+    QueueEncoder(pcnt_unit_t _unit)
+        : unit(_unit)
+    {
+        pcnt_config_t pcnt_config = {};
+        pcnt_config.unit = unit;
+        pcnt_config.counter_h_lim = H_LIM;
+        pcnt_config.counter_l_lim = L_LIM;
+        ESP_ERROR_CHECK(pcnt_unit_config(&pcnt_config));
+        pcnt_counter_pause(unit);
+        pcnt_counter_clear(unit);
+        pcnt_evt_queue = xQueueCreate(10, sizeof(pcnt_evt_t));
+        pcnt_isr_handler_add(unit, quad_enc_isr, this);
+        pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+        pcnt_event_enable(unit, PCNT_EVT_L_LIM);
+        pcnt_counter_resume(unit);
+    }
+
+    int64_t poll()
+    {
+        pcnt_evt_t evt;
+        if (xQueueReceive(pcnt_evt_queue, &evt, 0) == pdTRUE)
+        {
+            if (evt.status & PCNT_EVT_L_LIM)
+                evt.enc->accumulated += L_LIM;
+            if (evt.status & PCNT_EVT_H_LIM)
+                evt.enc->accumulated += H_LIM;
+        }
+        int16_t temp_count;
+        pcnt_get_counter_value(unit, &temp_count);
+        return temp_count + accumulated;
+    }
+
+private:
+    struct pcnt_evt_t
+    {
+        QueueEncoder* enc = 0;
+        uint32_t status = 0;
+    };
+
+    static void quad_enc_isr(void* arg)
+    {
+        auto enc = (QueueEncoder*) arg;
+        uint32_t status = 0;
+        pcnt_get_event_status(enc->unit, &status);
+        if (status & (PCNT_EVT_L_LIM | PCNT_EVT_H_LIM))
+        {
+            pcnt_evt_t evt;
+            evt.enc = enc;
+            evt.status = status;
+            xQueueSendFromISR(enc->pcnt_evt_queue, &evt, nullptr);
+        }
+    }
+
+    pcnt_unit_t unit;
+    QueueHandle_t pcnt_evt_queue = nullptr;
+    int64_t accumulated = 0;
+};
+
+struct Result
+{
+    double read_ns = 0;
+    long checks = 0;
+    long errors = 0;
+    int64_t max_error = 0;
+    int64_t final_error = 0;
+};
+
+template<typename E>
+Result run(E& enc, int reads, int turns, int pulses_per_turn)
+{
+    auto& plant = Plant::instance();
+    Result r;
+
+    // Read cost with the knob at rest
+    const auto start = std::chrono::steady_clock::now();
+    int64_t sink = 0;
+    for (int i = 0; i < reads; ++i)
+        sink += enc.poll();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    r.read_ns = std::chrono::duration<double, std::nano>(elapsed).count()/reads;
+    if (sink == 42)
+        printf("\n");
+
+    // Spin the knob in another thread while polling
+    std::atomic<int64_t> truth{0};
+    std::atomic<bool> done{false};
+    std::thread spinner([&]()
+    {
+        for (int i = 0; i < turns; ++i)
+        {
+            const int dir = (i/200) % 2 ? -1 : 1;
+            plant.turn(dir*pulses_per_turn);
+            truth += dir*pulses_per_turn;
+        }
+        done = true;
+    });
+    while (!done)
+    {
+        const auto before = truth.load();
+        const auto pos = enc.poll();
+        const auto after = truth.load();
+        ++r.checks;
+        const auto error = std::max(std::min(before, after) - pos, pos - std::max(before, after));
+        if (error > pulses_per_turn)
+        {
+            ++r.errors;
+            r.max_error = std::max(r.max_error, error);
+        }
+    }
+    spinner.join();
+    r.final_error = std::llabs(enc.poll() - truth.load());
+    return r;
+}
+
+static void report(const char* name, const Result& r)
+{
+    printf("encoder/%s read_ns=%.1f checks=%ld errors=%ld max_error=%lld final_error=%lld\n",
+           name, r.read_ns, r.checks, r.errors, (long long) r.max_error, (long long) r.final_error);
+}
+
+int main(int argc, char** argv)
+{
+    const int reads = argc > 1 ? atoi(argv[1]) : 1000000;
+    const int turns = argc > 2 ? atoi(argv[2]) : 20000;
+    // Large enough for several overflows per burst
+    const int pulses_per_turn = 300;
+
+    Plant::Config config;
+    config.lock_stop = -1e9;
+    config.unlock_stop = 1e9;
+    config.start_position = 0;
+    Plant::instance().configure(config);
+
+    {
+        QueueEncoder enc(PCNT_UNIT_0);
+        report("queue", run(enc, reads, turns, pulses_per_turn));
+    }
+    {
+        Encoder enc(PCNT_UNIT_0, 0, 0);
+        report("seqlock", run(enc, reads, turns, pulses_per_turn));
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Microbenchmarks of the firmware hot paths on the host, in ns per call.
+// The cases are those of the 'bench' console command (see microbench.h),
+// which reports CPU cycles on the target.
+//
+//   bench_micro [min_ms]
+//
+// Output, one line per case:
+//   BENCH <case> <ns per call> ns <iterations>
+//
+// The firmware is started on the virtual clock and the cases run in the
+// console task, so no other simulated thread runs while they are timed.
+
+#include "plant.h"
+#include "sim.h"
+
+#include "microbench.h"
+
+#include <esp_console.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+extern "C" void app_main();
+
+static FILE* out = nullptr;
+static uint32_t min_ns = 0;
+
+static uint32_t ns_clock()
+{
+    return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int bench_host(int, char**)
+{
+    // Nothing else runs meanwhile, so the motion task cases can run here too
+    microbench_run(MICROBENCH_MOTION, out, &ns_clock, "ns", min_ns);
+    microbench_run(MICROBENCH_CONSOLE, out, &ns_clock, "ns", min_ns);
+    fflush(out);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    min_ns = (argc > 1 ? atoi(argv[1]) : 100)*1000000u;
+
+    // Keep the results apart from what the firmware prints
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out || !freopen("/dev/null", "w", stdout))
+        return 1;
+    int input[2];
+    if (pipe(input) || write(input[1], "bench_host\n", 11) != 11)
+        return 1;
+    close(input[1]);
+    dup2(input[0], STDIN_FILENO);
+    close(input[0]);
+
+    sim_use_virtual_time();
+    auto& plant = Plant::instance();
+    plant.configure(Plant::Config());
+    const esp_console_cmd_t cmd = { "bench_host", "Run the microbenchmarks", nullptr, &bench_host, nullptr };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+    plant.start();
+
+    // The simulation ends when the console has read all its input
+    app_main();
+    sim_thread_exit();
+    while (true)
+        std::this_thread::sleep_for(std::chrono::hours(1));
+}
@@ -0,0 +1,374 @@
+// Endurance soak: runs the lock, status and unlock commands for many cycles
+// against the simulated mechanism on the virtual clock, for every
+// combination of default motor power and backoff given, and reports how
+// long locking and unlocking take and how often they fail.
+//
+//   bench_soak [-n cycles] [-P power,...] [-b backoff,...] [-f dead_zone]
+//              [-F friction_noise] [-s slack] [-S slack_noise] [-r seed]
+//              [-w bucket_ms] [-j jobs]
+//
+// Before each cycle the duty dead zone (friction) and the gearbox slack are
+// drawn uniformly from base +/- noise. Runs are repeatable for a given seed.
+//
+// Output, one line per configuration, then the latency histograms:
+//   soak power=<p> backoff=<b> cycles=<n> calibrated=<0|1> lock_failures=<n>
+//     unlock_failures=<n> timeouts=<n> lock_p50_ms=<ms> lock_p99_ms=<ms>
+//     lock_p999_ms=<ms> lock_max_ms=<ms> unlock_p50_ms=<ms> ... wall_s=<s>
+//   soak_hist power=<p> backoff=<b> op=<lock|unlock> low_ms=<ms> count=<n>
+//
+// A failure is a job that does not end in the expected state; a timeout is
+// also counted as a failure. Latency is from the command to the end of the
+// job, failed jobs included.
+//
+// Each configuration runs in a process of its own, as the firmware can only
+// be started once, and up to 'jobs' of them run at the same time.
+
+#include "plant.h"
+#include "sim.h"
+
+#include "defines.h"
+#include "job_queue.h"
+#include "status.h"
+
+#include <esp_console.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" void app_main();
+
+struct Options
+{
+    int cycles = 1000;
+    std::vector<int> powers = { 300, MOTOR_DEFAULT_POWER, 800 };
+    std::vector<int> backoffs = { 10, DEFAULT_BACKOFF_PULSES };
+    int dead_zone = Plant::Config().duty_dead_zone;
+    int friction_noise = 20;
+    double slack = Plant::Config().slack;
+    double slack_noise = 1;
+    unsigned seed = 1;
+    int bucket_ms = 50;
+    int jobs = 0;
+};
+
+struct Result
+{
+    bool is_calibrated = false;
+    int lock_failures = 0;
+    int unlock_failures = 0;
+    int timeouts = 0;
+    std::vector<int64_t> lock_us;
+    std::vector<int64_t> unlock_us;
+};
+
+// What the 'soak' command runs, set before the firmware starts
+static Options options;
+static int power;
+static int backoff;
+static int result_fd = -1;
+
+static void run_command(const std::string& command)
+{
+    int ret = 0;
+    esp_console_run(command.c_str(), &ret);
+}
+
+// Run a motion command to completion, aborting it if it takes longer than
+// the 'wait' command would wait. Return its duration, or -1 on timeout.
+static int64_t run_job(const char* command)
+{
+    const auto start = sim_time_us();
+    run_command(command);
+    const auto id = jobs.get_last_id();
+    if (!jobs.wait(id, MAX_JOB_WAIT_MS/portTICK_PERIOD_MS))
+    {
+        jobs.abort();
+        jobs.wait(id, portMAX_DELAY);
+        return -1;
+    }
+    return sim_time_us() - start;
+}
+
+static int64_t percentile(const std::vector<int64_t>& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    const auto i = std::min(sorted.size() - 1, (size_t) (fraction*sorted.size()));
+    return sorted[i];
+}
+
+static void format_latency(std::ostream& out, const char* op, std::vector<int64_t>& us)
+{
+    std::sort(us.begin(), us.end());
+    out << ' ' << op << "_p50_ms=" << percentile(us, 0.5)/1000.0
+        << ' ' << op << "_p99_ms=" << percentile(us, 0.99)/1000.0
+        << ' ' << op << "_p999_ms=" << percentile(us, 0.999)/1000.0
+        << ' ' << op << "_max_ms=" << (us.empty() ? 0 : us.back())/1000.0;
+}
+
+static void format_histogram(std::ostream& out, const char* op, const std::vector<int64_t>& us)
+{
+    std::map<int64_t, int> buckets;
+    for (auto t : us)
+        ++buckets[t/1000/options.bucket_ms];
+    for (const auto& b : buckets)
+        out << "soak_hist power=" << power << " backoff=" << backoff << " op=" << op
+            << " low_ms=" << b.first*options.bucket_ms << " count=" << b.second << '\n';
+}
+
+static std::string format_result(Result& r, double wall_s)
+{
+    std::ostringstream out;
+    out << "soak power=" << power << " backoff=" << backoff << " cycles=" << options.cycles
+        << " calibrated=" << r.is_calibrated
+        << " lock_failures=" << r.lock_failures << " unlock_failures=" << r.unlock_failures
+        << " timeouts=" << r.timeouts;
+    format_latency(out, "lock", r.lock_us);
+    format_latency(out, "unlock", r.unlock_us);
+    out << " wall_s=" << wall_s << '\n';
+    format_histogram(out, "lock", r.lock_us);
+    format_histogram(out, "unlock", r.unlock_us);
+    return out.str();
+}
+
+// Run one lock or unlock and check that it ends in 'expected'
+static void cycle_step(const char* command, State expected, std::vector<int64_t>& latencies,
+                       int& failures, int& timeouts)
+{
+    const auto us = run_job(command);
+    if (us < 0)
+    {
+        ++timeouts;
+        ++failures;
+        return;
+    }
+    latencies.push_back(us);
+    // The state is published before the job is reported as done
+    run_command("status");
+    if (status_publisher.read().state != expected)
+        ++failures;
+}
+
+static int soak(int, char**)
+{
+    const auto start = std::chrono::steady_clock::now();
+    Result r;
+    r.lock_us.reserve(options.cycles);
+    r.unlock_us.reserve(options.cycles);
+    run_command("set_power " + std::to_string(power));
+    run_command("set_backoff " + std::to_string(backoff));
+    run_job("calibrate");
+    r.is_calibrated = status_publisher.read().is_calibrated;
+
+    auto& plant = Plant::instance();
+    std::mt19937 rng(options.seed);
+    std::uniform_int_distribution<int> friction(-options.friction_noise, options.friction_noise);
+    std::uniform_real_distribution<double> slack(-options.slack_noise, options.slack_noise);
+    for (int i = 0; r.is_calibrated && i < options.cycles; ++i)
+    {
+        plant.set_friction(options.dead_zone + friction(rng));
+        plant.set_slack(std::max(0.0, options.slack + slack(rng)));
+        cycle_step("lock", Locked, r.lock_us, r.lock_failures, r.timeouts);
+        cycle_step("unlock", Unlocked, r.unlock_us, r.unlock_failures, r.timeouts);
+    }
+
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    const auto text = format_result(r, wall.count());
+    if (write(result_fd, text.data(), text.size()) != (ssize_t) text.size())
+        sim_fail();
+    sim_exit();
+}
+
+// Run the firmware with the soak in the console task. Does not return.
+[[noreturn]] static void run_configuration(int fd)
+{
+    result_fd = fd;
+    // The firmware's output, and the timing of every command, is not wanted
+    if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr))
+        _exit(2);
+    int input[2];
+    if (pipe(input) || write(input[1], "soak\n", 5) != 5)
+        _exit(2);
+    close(input[1]);
+    dup2(input[0], STDIN_FILENO);
+    close(input[0]);
+
+    sim_use_virtual_time();
+    Plant::Config config;
+    config.duty_dead_zone = options.dead_zone;
+    config.slack = options.slack;
+    auto& plant = Plant::instance();
+    plant.configure(config);
+    const esp_console_cmd_t cmd = { "soak", "Run the soak", nullptr, &soak, nullptr };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+    plant.start();
+
+    app_main();
+    sim_thread_exit();
+    while (true)
+        std::this_thread::sleep_for(std::chrono::hours(1));
+}
+
+struct Child
+{
+    pid_t pid;
+    int fd;
+    int power;
+    int backoff;
+};
+
+static Child start_configuration(int pwr, int bo)
+{
+    int fds[2];
+    if (pipe(fds))
+    {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    const auto pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        power = pwr;
+        backoff = bo;
+        run_configuration(fds[1]);
+    }
+    close(fds[1]);
+    return { pid, fds[0], pwr, bo };
+}
+
+// Print what a child reported. Return false if it failed.
+static bool finish_configuration(const Child& child)
+{
+    std::string text;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(child.fd, buf, sizeof(buf))) > 0)
+        text.append(buf, n);
+    close(child.fd);
+    int status = 0;
+    waitpid(child.pid, &status, 0);
+    const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && !text.empty();
+    if (ok)
+        fputs(text.c_str(), stdout);
+    else
+        printf("soak power=%d backoff=%d error=%d\n", child.power, child.backoff, status);
+    fflush(stdout);
+    return ok;
+}
+
+static std::vector<int> parse_list(const char* arg)
+{
+    std::vector<int> values;
+    std::istringstream in(arg);
+    std::string item;
+    while (std::getline(in, item, ','))
+        values.push_back(atoi(item.c_str()));
+    return values;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-n cycles] [-P power,...] [-b backoff,...] [-f dead_zone] [-F noise]\n"
+            "          [-s slack] [-S noise] [-r seed] [-w bucket_ms] [-j jobs]\n"
+            "  -n  lock/unlock cycles per configuration\n"
+            "  -P  default motor powers to try\n"
+            "  -b  backoffs to try, in pulses\n"
+            "  -f  motor duty dead zone (friction), -F its variation per cycle\n"
+            "  -s  gearbox dead band in pulses, -S its variation per cycle\n"
+            "  -r  random seed\n"
+            "  -w  histogram bucket width in ms\n"
+            "  -j  configurations to run at once (default: one per CPU)\n",
+            argv0);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:P:b:f:F:s:S:r:w:j:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            options.cycles = atoi(optarg);
+            break;
+        case 'P':
+            options.powers = parse_list(optarg);
+            break;
+        case 'b':
+            options.backoffs = parse_list(optarg);
+            break;
+        case 'f':
+            options.dead_zone = atoi(optarg);
+            break;
+        case 'F':
+            options.friction_noise = atoi(optarg);
+            break;
+        case 's':
+            options.slack = atof(optarg);
+            break;
+        case 'S':
+            options.slack_noise = atof(optarg);
+            break;
+        case 'r':
+            options.seed = strtoul(optarg, nullptr, 0);
+            break;
+        case 'w':
+            options.bucket_ms = atoi(optarg);
+            break;
+        case 'j':
+            options.jobs = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (options.cycles < 0 || options.bucket_ms <= 0 || options.friction_noise < 0 ||
+        options.powers.empty() || options.backoffs.empty())
+        usage(argv[0]);
+    if (options.jobs <= 0)
+        options.jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::pair<int, int>> configurations;
+    for (auto p : options.powers)
+        for (auto b : options.backoffs)
+            configurations.emplace_back(p, b);
+
+    // Results are printed in the order of the configurations
+    int failed = 0;
+    std::vector<Child> running;
+    size_t next = 0;
+    while (next < configurations.size() || !running.empty())
+    {
+        while (next < configurations.size() && (int) running.size() < options.jobs)
+        {
+            running.push_back(start_configuration(configurations[next].first,
+                                                  configurations[next].second));
+            ++next;
+        }
+        if (!finish_configuration(running.front()))
+            ++failed;
+        running.erase(running.begin());
+    }
+    return failed;
+}
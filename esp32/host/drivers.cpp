@@ -0,0 +1,273 @@
+// Host stand-ins for the ESP-IDF peripheral drivers. Everything that touches
+// the lock mechanism is forwarded to the Plant.
+
+#include "plant.h"
+#include "sim.h"
+
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+#include <driver/pcnt.h>
+#include <driver/uart.h>
+#include <esp_system.h>
+#include <esp_vfs_dev.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+std::atomic<int> failures{0};
+
+struct LedcChannel
+{
+    int gpio = -1;
+    uint32_t duty = 0;
+    uint32_t pending_duty = 0;
+};
+
+LedcChannel ledc_channels[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+void sim_fail()
+{
+    ++failures;
+}
+
+bool sim_has_failed()
+{
+    return failures > 0;
+}
+
+void sim_exit()
+{
+    fflush(stdout);
+    fflush(stderr);
+    std::_Exit(failures ? 1 : 0);
+}
+
+void esp_restart()
+{
+    fflush(stdout);
+    std::_Exit(0);
+}
+
+esp_err_t gpio_config(const gpio_config_t* config)
+{
+    for (int pin = 0; pin < GPIO_NUM_MAX; ++pin)
+        if (config->pin_bit_mask & (1ULL << pin))
+            Plant::instance().gpio_enable_intr(pin, config->intr_type != GPIO_INTR_DISABLE);
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void* args)
+{
+    Plant::instance().gpio_set_isr(gpio_num, isr_handler, args);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t, gpio_int_type_t)
+{
+    // All inputs interrupt on any edge
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    Plant::instance().gpio_enable_intr(gpio_num, true);
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    Plant::instance().gpio_enable_intr(gpio_num, false);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    Plant::instance().set_gpio(gpio_num, level);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return Plant::instance().get_gpio(gpio_num);
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t*)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t* conf)
+{
+    auto& ch = ledc_channels[conf->speed_mode][conf->channel];
+    ch.gpio = conf->gpio_num;
+    ch.duty = ch.pending_duty = conf->duty;
+    Plant::instance().set_pwm(ch.gpio, ch.duty);
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    ledc_channels[speed_mode][channel].pending_duty = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    auto& ch = ledc_channels[speed_mode][channel];
+    ch.duty = ch.pending_duty;
+    Plant::instance().set_pwm(ch.gpio, ch.duty);
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return ledc_channels[speed_mode][channel].duty;
+}
+
+esp_err_t pcnt_unit_config(const pcnt_config_t* conf)
+{
+    // Quadrature decoding is done by the plant, which reports signed steps
+    Plant::instance().pcnt_config(conf->unit, conf->counter_h_lim, conf->counter_l_lim);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t* count)
+{
+    *count = Plant::instance().pcnt_get_count(unit);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit)
+{
+    Plant::instance().pcnt_set_running(unit, false);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit)
+{
+    Plant::instance().pcnt_set_running(unit, true);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit)
+{
+    Plant::instance().pcnt_clear(unit);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t evt_type)
+{
+    Plant::instance().pcnt_enable_event(unit, evt_type, true);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_event_disable(pcnt_unit_t unit, pcnt_evt_type_t evt_type)
+{
+    Plant::instance().pcnt_enable_event(unit, evt_type, false);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_set_event_value(pcnt_unit_t unit, pcnt_evt_type_t evt_type, int16_t value)
+{
+    Plant::instance().pcnt_set_event_value(unit, evt_type, value);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_get_event_status(pcnt_unit_t unit, uint32_t* status)
+{
+    *status = Plant::instance().pcnt_get_status(unit);
+    return ESP_OK;
+}
+
+esp_err_t pcnt_set_filter_value(pcnt_unit_t, uint16_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_filter_enable(pcnt_unit_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_service_install(int)
+{
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*isr_handler)(void*), void* args)
+{
+    Plant::instance().pcnt_set_isr(unit, isr_handler, args);
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t, const uart_config_t*)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t, int, int, int, QueueHandle_t*, int)
+{
+    return ESP_OK;
+}
+
+// The console UART is stdin/stdout. Reads block regardless of the timeout,
+// and the simulation ends with the input, as for linenoise.
+int uart_read_bytes(uart_port_t, void* buf, uint32_t length, TickType_t)
+{
+    const auto n = fread(buf, 1, length, stdin);
+    if (n < length && feof(stdin))
+        sim_exit();
+    return (int) n;
+}
+
+int uart_write_bytes(uart_port_t, const void* src, size_t size)
+{
+    // Keep the order with anything printed
+    fflush(stdout);
+    const auto n = fwrite(src, 1, size, stdout);
+    fflush(stdout);
+    return (int) n;
+}
+
+void esp_vfs_dev_uart_port_set_rx_line_endings(int, esp_line_endings_t)
+{
+}
+
+void esp_vfs_dev_uart_port_set_tx_line_endings(int, esp_line_endings_t)
+{
+}
+
+void esp_vfs_dev_uart_use_driver(int)
+{
+}
@@ -0,0 +1,106 @@
+// Host stand-in for esp_console. Every command run is timed and reported on
+// stderr, so that stdout carries exactly what the firmware prints.
+
+#include "sim.h"
+
+#include <esp_console.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Command
+{
+    std::string command;
+    std::string help;
+    esp_console_cmd_func_t func;
+};
+
+std::vector<Command>& commands()
+{
+    static std::vector<Command> c;
+    return c;
+}
+
+int help(int, char**)
+{
+    for (const auto& c : commands())
+        printf("%s\n  %s\n", c.command.c_str(), c.help.c_str());
+    return 0;
+}
+
+}
+
+esp_err_t esp_console_init(const esp_console_config_t*)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t* cmd)
+{
+    if (!cmd->command || strchr(cmd->command, ' '))
+        return ESP_ERR_INVALID_ARG;
+    for (auto& c : commands())
+        if (c.command == cmd->command)
+        {
+            c.help = cmd->help ? cmd->help : "";
+            c.func = cmd->func;
+            return ESP_OK;
+        }
+    commands().push_back({ cmd->command, cmd->help ? cmd->help : "", cmd->func });
+    return ESP_OK;
+}
+
+esp_err_t esp_console_register_help_command()
+{
+    const esp_console_cmd_t help_cmd = {
+        .command = "help",
+        .help = "Print the list of registered commands",
+        .hint = nullptr,
+        .func = &help,
+        .argtable = nullptr
+    };
+    return esp_console_cmd_register(&help_cmd);
+}
+
+esp_err_t esp_console_run(const char* cmdline, int* cmd_ret)
+{
+    std::vector<std::string> words;
+    std::string word;
+    for (const char* p = cmdline; ; ++p)
+    {
+        if (*p == 0 || isspace((unsigned char) *p))
+        {
+            if (!word.empty())
+                words.push_back(word);
+            word.clear();
+            if (*p == 0)
+                break;
+        }
+        else
+            word += *p;
+    }
+    if (words.empty())
+        return ESP_ERR_INVALID_ARG;
+
+    for (const auto& c : commands())
+    {
+        if (c.command != words[0])
+            continue;
+        std::vector<char*> argv;
+        for (auto& w : words)
+            argv.push_back(&w[0]);
+        argv.push_back(nullptr);
+        const auto start = sim_time_us();
+        *cmd_ret = c.func((int) words.size(), argv.data());
+        fflush(stdout);
+        fprintf(stderr, "SIM: %s took %.1f ms\n", cmdline, (sim_time_us() - start)/1000.0);
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,139 @@
+// Host stand-in for esp_timer. Callbacks run one at a time in a dedicated
+// thread, like the esp_timer task.
+
+#include "sim.h"
+
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct esp_timer
+{
+    esp_timer_cb_t callback = nullptr;
+    void* arg = nullptr;
+    std::string name;
+    /// Next expiry, or -1 if not running
+    int64_t expiry_us = -1;
+    uint64_t period_us = 0;
+};
+
+namespace
+{
+
+struct TimerService
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<esp_timer*> timers;
+    bool is_running = false;
+
+    /// Start the thread on first use, as timers are created before main()
+    void start_thread()
+    {
+        if (is_running)
+            return;
+        is_running = true;
+        sim_thread_start("esp_timer", SIM_TIMER_PRIORITY, [this]() { run(); });
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            esp_timer* next = nullptr;
+            for (auto t : timers)
+                if (t->expiry_us >= 0 && (!next || t->expiry_us < next->expiry_us))
+                    next = t;
+            if (!next)
+            {
+                sim_wait_until_us(lock, cond, -1);
+                continue;
+            }
+            if (sim_time_us() < next->expiry_us)
+            {
+                sim_wait_until_us(lock, cond, next->expiry_us);
+                continue;
+            }
+            next->expiry_us = next->period_us ? next->expiry_us + next->period_us : -1;
+            auto cb = next->callback;
+            auto arg = next->arg;
+            // Callbacks may start and stop timers
+            lock.unlock();
+            cb(arg);
+            lock.lock();
+        }
+    }
+};
+
+TimerService& service()
+{
+    static TimerService s;
+    return s;
+}
+
+}
+
+int64_t esp_timer_get_time()
+{
+    return sim_time_us();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle)
+{
+    auto& s = service();
+    auto t = new esp_timer;
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->name = args->name ? args->name : "";
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.timers.push_back(t);
+    *out_handle = t;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    auto& s = service();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (timer->expiry_us >= 0)
+        return ESP_ERR_INVALID_STATE;
+    timer->expiry_us = sim_time_us() + timeout_us;
+    timer->period_us = period_us;
+    s.start_thread();
+    sim_notify_all(s.cond);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    auto& s = service();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (timer->expiry_us < 0)
+        return ESP_ERR_INVALID_STATE;
+    timer->expiry_us = -1;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    auto& s = service();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (timer->expiry_us >= 0)
+        return ESP_ERR_INVALID_STATE;
+    s.timers.erase(std::find(s.timers.begin(), s.timers.end(), timer));
+    delete timer;
+    return ESP_OK;
+}
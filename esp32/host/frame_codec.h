@@ -0,0 +1,38 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Host side of the framed protocol in protocol.h, for tools and tests that
+/// talk to the firmware, or to danalock_sim, over the console.
+
+/// Encode 'frame' as it is sent on the wire, SYNC and CRC included.
+std::vector<uint8_t> frame_encode(const Frame& frame);
+
+/// Splits what the console sends into frames and text. Feed it the bytes
+/// as they arrive, then take out the frames that are complete.
+class FrameDecoder
+{
+public:
+    void feed(const uint8_t* data, size_t length);
+
+    /// Take the next complete frame. Text before it is added to get_text().
+    /// A SYNC byte that does not start a frame with a valid CRC is skipped.
+    /// Return false if there is no complete frame yet.
+    bool next(Frame& frame);
+
+    /// Everything received outside frames so far.
+    const std::string& get_text() const;
+
+    /// Number of SYNC bytes skipped because of a bad length or CRC.
+    uint32_t get_errors() const;
+
+private:
+    std::vector<uint8_t> buffer;
+    std::string text;
+    uint32_t errors = 0;
+};
@@ -0,0 +1,514 @@
+// Host stand-in for the FreeRTOS task, tick and queue APIs.
+// Tasks are native threads. One tick is one millisecond, of wall time by
+// default, or of virtual time after sim_use_virtual_time().
+//
+// On the virtual clock the simulated threads take turns like tasks on a
+// single core: only the running thread executes, the highest priority ready
+// thread runs next, and when every thread is waiting the clock jumps to the
+// earliest deadline. A thread only gives up its turn when it waits, or when
+// it wakes a higher priority thread from a task (not an ISR), so a run is
+// the same every time for the same input. Periodic callbacks standing in
+// for hardware run inside the scheduler as the clock passes their times,
+// like interrupts, rather than as threads that must be switched to.
+
+#include "sim.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static_assert(portTICK_PERIOD_MS == 1, "host tick is one millisecond");
+
+struct sim_task
+{
+    std::string name;
+    TaskFunction_t fn = nullptr;
+    void* param = nullptr;
+};
+
+struct sim_queue
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length = 0;
+    UBaseType_t item_size = 0;
+};
+
+namespace
+{
+
+struct SimThread
+{
+    enum State { Ready, Running, Blocked };
+
+    std::string name;
+    int priority = 0;
+    /// Signalled when the thread is given its turn
+    std::condition_variable turn;
+    State state = Ready;
+    /// When to wake if blocked, or -1
+    int64_t wake_us = -1;
+    /// What the thread is waiting for, if anything but time
+    const void* wait_key = nullptr;
+    bool timed_out = false;
+    /// Orders threads of the same priority by when they became ready
+    uint64_t ready_order = 0;
+};
+
+struct Periodic
+{
+    int64_t period_us = 0;
+    int64_t next_us = 0;
+    std::function<void()> fn;
+};
+
+struct Scheduler
+{
+    std::mutex mutex;
+    std::atomic<bool> is_virtual{false};
+    std::atomic<int64_t> now_us{0};
+    uint64_t next_ready_order = 0;
+    /// In order of creation, which breaks ties between deadlines
+    std::vector<SimThread*> threads;
+    /// In order of creation, which is the order they run in at a given time
+    std::vector<Periodic*> periodics;
+    /// Stands in for the current thread while a periodic callback runs, so
+    /// that nothing it calls gives up the core
+    SimThread interrupt;
+};
+
+Scheduler& scheduler()
+{
+    static Scheduler s;
+    return s;
+}
+
+thread_local SimThread* current_thread = nullptr;
+
+void make_ready(Scheduler& s, SimThread* t)
+{
+    t->state = SimThread::Ready;
+    t->wake_us = -1;
+    t->wait_key = nullptr;
+    t->ready_order = s.next_ready_order++;
+}
+
+SimThread* best_ready(Scheduler& s)
+{
+    SimThread* best = nullptr;
+    for (auto t : s.threads)
+        if (t->state == SimThread::Ready &&
+            (!best || t->priority > best->priority ||
+             (t->priority == best->priority && t->ready_order < best->ready_order)))
+            best = t;
+    return best;
+}
+
+/// Run the periodic callbacks due at the current time. The scheduler is
+/// unlocked meanwhile, as they may wake threads.
+void run_periodics(std::unique_lock<std::mutex>& lock, Scheduler& s)
+{
+    const auto saved = current_thread;
+    current_thread = &s.interrupt;
+    for (auto p : s.periodics)
+        if (p->next_us == s.now_us)
+        {
+            p->next_us += p->period_us;
+            lock.unlock();
+            p->fn();
+            lock.lock();
+        }
+    current_thread = saved;
+}
+
+/// Pick the thread to run next, advancing the clock if none is ready.
+SimThread* next_thread(std::unique_lock<std::mutex>& lock, Scheduler& s)
+{
+    while (true)
+    {
+        if (auto t = best_ready(s))
+            return t;
+        int64_t earliest = -1;
+        for (auto t : s.threads)
+            if (t->state == SimThread::Blocked && t->wake_us >= 0 &&
+                (earliest < 0 || t->wake_us < earliest))
+                earliest = t->wake_us;
+        for (auto p : s.periodics)
+            if (earliest < 0 || p->next_us < earliest)
+                earliest = p->next_us;
+        if (earliest < 0)
+        {
+            fprintf(stderr, "SIM: all threads are waiting forever\n");
+            fflush(stdout);
+            std::_Exit(1);
+        }
+        s.now_us = earliest;
+        for (auto t : s.threads)
+            if (t->state == SimThread::Blocked && t->wake_us == earliest)
+            {
+                make_ready(s, t);
+                t->timed_out = true;
+            }
+        run_periodics(lock, s);
+    }
+}
+
+void wait_for_turn(std::unique_lock<std::mutex>& lock, SimThread* self)
+{
+    while (self->state != SimThread::Running)
+        self->turn.wait(lock);
+}
+
+/// Hand the core to the next thread and wait until it is our turn again.
+/// The caller has set its own state.
+void switch_away(std::unique_lock<std::mutex>& lock, SimThread* self)
+{
+    auto next = next_thread(lock, scheduler());
+    next->state = SimThread::Running;
+    if (next != self)
+    {
+        // Notified unlocked, so that it does not wake only to wait for the lock
+        lock.unlock();
+        next->turn.notify_one();
+        lock.lock();
+        wait_for_turn(lock, self);
+    }
+}
+
+SimThread* get_current_thread()
+{
+    if (!current_thread)
+    {
+        fprintf(stderr, "SIM: thread not started with sim_thread_start() waits on the virtual clock\n");
+        std::_Exit(1);
+    }
+    return current_thread;
+}
+
+/// Give up the core to a ready thread of higher priority, or also of the
+/// same priority if 'round_robin' is set.
+void yield(bool round_robin)
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+    {
+        if (round_robin)
+            std::this_thread::yield();
+        return;
+    }
+    std::unique_lock<std::mutex> lock(s.mutex);
+    auto self = get_current_thread();
+    auto best = best_ready(s);
+    if (!best || best->priority < self->priority ||
+        (best->priority == self->priority && !round_robin))
+        return;
+    make_ready(s, self);
+    switch_away(lock, self);
+}
+
+}
+
+static std::chrono::steady_clock::time_point start_time()
+{
+    static const auto t = std::chrono::steady_clock::now();
+    return t;
+}
+
+void sim_use_virtual_time()
+{
+    auto& s = scheduler();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.is_virtual = true;
+    auto self = new SimThread;
+    self->name = "main";
+    self->priority = 1;
+    self->state = SimThread::Running;
+    s.threads.push_back(self);
+    current_thread = self;
+    s.interrupt.name = "interrupt";
+    s.interrupt.priority = INT_MAX;
+    s.interrupt.state = SimThread::Running;
+}
+
+void sim_thread_start(const char* name, int priority, std::function<void()> fn)
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+    {
+        std::thread(fn).detach();
+        return;
+    }
+    auto t = new SimThread;
+    t->name = name;
+    t->priority = priority;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        make_ready(s, t);
+        s.threads.push_back(t);
+    }
+    std::thread([t, fn]()
+    {
+        current_thread = t;
+        {
+            std::unique_lock<std::mutex> lock(scheduler().mutex);
+            wait_for_turn(lock, t);
+        }
+        fn();
+        sim_thread_exit();
+    }).detach();
+}
+
+void sim_start_periodic(const char* name, int64_t period_us, std::function<void()> fn)
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+    {
+        sim_thread_start(name, SIM_PLANT_PRIORITY, [period_us, fn]()
+        {
+            auto t = sim_time_us();
+            while (true)
+            {
+                t += period_us;
+                sim_sleep_until_us(t);
+                fn();
+            }
+        });
+        return;
+    }
+    auto p = new Periodic;
+    p->period_us = period_us;
+    p->fn = fn;
+    std::lock_guard<std::mutex> lock(s.mutex);
+    p->next_us = s.now_us + period_us;
+    s.periodics.push_back(p);
+}
+
+void sim_thread_exit()
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+        return;
+    std::unique_lock<std::mutex> lock(s.mutex);
+    auto self = get_current_thread();
+    s.threads.erase(std::find(s.threads.begin(), s.threads.end(), self));
+    current_thread = nullptr;
+    auto next = next_thread(lock, s);
+    next->state = SimThread::Running;
+    next->turn.notify_one();
+    // The thread may go on outside the simulation, so it is not deleted
+}
+
+int64_t sim_time_us()
+{
+    auto& s = scheduler();
+    if (s.is_virtual)
+        return s.now_us;
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time()).count();
+}
+
+void sim_sleep_until_us(int64_t us)
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+    {
+        std::this_thread::sleep_until(start_time() + std::chrono::microseconds(us));
+        return;
+    }
+    std::unique_lock<std::mutex> lock(s.mutex);
+    auto self = get_current_thread();
+    if (us <= s.now_us)
+        return;
+    self->state = SimThread::Blocked;
+    self->wake_us = us;
+    switch_away(lock, self);
+}
+
+bool sim_wait_until_us(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                       int64_t deadline_us)
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+    {
+        if (deadline_us < 0)
+        {
+            cond.wait(lock);
+            return true;
+        }
+        return cond.wait_until(lock, start_time() + std::chrono::microseconds(deadline_us)) == std::cv_status::no_timeout;
+    }
+    bool timed_out = false;
+    {
+        std::unique_lock<std::mutex> sched_lock(s.mutex);
+        auto self = get_current_thread();
+        if (deadline_us >= 0 && deadline_us <= s.now_us)
+            return false;
+        self->state = SimThread::Blocked;
+        self->wake_us = deadline_us;
+        self->wait_key = &cond;
+        self->timed_out = false;
+        lock.unlock();
+        switch_away(sched_lock, self);
+        timed_out = self->timed_out;
+    }
+    lock.lock();
+    return !timed_out;
+}
+
+void sim_notify_all(std::condition_variable& cond)
+{
+    auto& s = scheduler();
+    if (!s.is_virtual)
+    {
+        cond.notify_all();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (auto t : s.threads)
+        if (t->state == SimThread::Blocked && t->wait_key == &cond)
+            make_ready(s, t);
+}
+
+static int64_t deadline_us(TickType_t ticks)
+{
+    return ticks == portMAX_DELAY ? -1 : sim_time_us() + ticks*1000LL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t,
+                       void* param, UBaseType_t priority, TaskHandle_t* handle)
+{
+    auto task = new sim_task;
+    task->name = name;
+    task->fn = fn;
+    task->param = param;
+    sim_thread_start(name, priority, [task]() { task->fn(task->param); });
+    if (handle)
+        *handle = task;
+    // A new task of higher priority runs at once
+    yield(false);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth,
+                                   void* param, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t)
+{
+    return xTaskCreate(fn, name, stack_depth, param, priority, handle);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0)
+        yield(true);
+    else
+        sim_sleep_until_us(sim_time_us() + ticks*1000LL);
+}
+
+void vTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment)
+{
+    *previous_wake_time += increment;
+    sim_sleep_until_us(*previous_wake_time*1000LL);
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t) (sim_time_us()/1000);
+}
+
+TickType_t xTaskGetTickCountFromISR()
+{
+    return xTaskGetTickCount();
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    auto q = new sim_queue;
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void* item, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(q->mutex);
+    const auto deadline = deadline_us(ticks_to_wait);
+    while (q->items.size() >= q->length)
+        if (!ticks_to_wait || (!sim_wait_until_us(lock, q->cond, deadline) && q->items.size() >= q->length))
+            return errQUEUE_FULL;
+    std::vector<uint8_t> v(q->item_size);
+    if (q->item_size)
+        memcpy(v.data(), item, q->item_size);
+    q->items.push_back(std::move(v));
+    sim_notify_all(q->cond);
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks_to_wait)
+{
+    const auto res = queue_send(q, item, ticks_to_wait);
+    // Let a receiver of higher priority run, as FreeRTOS would
+    yield(false);
+    return res;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* higher_prio_woken)
+{
+    if (higher_prio_woken)
+        *higher_prio_woken = pdFALSE;
+    // The interrupted thread keeps the core (and any lock it holds)
+    return queue_send(q, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(q->mutex);
+    const auto deadline = deadline_us(ticks_to_wait);
+    while (q->items.empty())
+        if (!ticks_to_wait || (!sim_wait_until_us(lock, q->cond, deadline) && q->items.empty()))
+            return pdFALSE;
+    if (q->item_size)
+        memcpy(item, q->items.front().data(), q->item_size);
+    q->items.pop_front();
+    sim_notify_all(q->cond);
+    lock.unlock();
+    yield(false);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    auto sem = xQueueCreate(1, 0);
+    xQueueSend(sem, nullptr, 0);
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return xQueueCreate(1, 0);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdio.h>
+
+// Host stand-in for the argtable3 subset used by the console commands:
+// positional integer arguments terminated by an arg_end.
+
+enum {
+    ARG_TERMINATOR = 0x1,
+    ARG_HASVALUE = 0x2
+};
+
+struct arg_hdr
+{
+    char flag;
+    const char* datatype;
+    const char* glossary;
+    int mincount;
+    int maxcount;
+};
+
+struct arg_int
+{
+    struct arg_hdr hdr;
+    int count;
+    int* ival;
+};
+
+struct arg_end
+{
+    struct arg_hdr hdr;
+    int count;
+    int* error;
+    const char** argval;
+};
+
+struct arg_int* arg_int1(const char* shortopts, const char* longopts,
+                         const char* datatype, const char* glossary);
+struct arg_end* arg_end(int maxcount);
+int arg_parse(int argc, char** argv, void** argtable);
+void arg_print_errors(FILE* fp, struct arg_end* end, const char* progname);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+typedef struct {
+    size_t max_cmdline_length;
+    size_t max_cmdline_args;
+    int hint_color;
+    int hint_bold;
+} esp_console_config_t;
+
+typedef int (*esp_console_cmd_func_t)(int argc, char** argv);
+
+typedef struct {
+    const char* command;
+    const char* help;
+    const char* hint;
+    esp_console_cmd_func_t func;
+    void* argtable;
+} esp_console_cmd_t;
+
+esp_err_t esp_console_init(const esp_console_config_t* config);
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t* cmd);
+esp_err_t esp_console_run(const char* cmdline, int* cmd_ret);
+esp_err_t esp_console_register_help_command();
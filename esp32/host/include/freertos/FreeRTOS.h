@@ -0,0 +1,34 @@
+#pragma once
+
+// Host stand-in for the subset of FreeRTOS used by the firmware.
+// Tasks are native threads and one tick is one millisecond, of wall time
+// or of the simulator's virtual clock.
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define portBASE_TYPE           int
+#define pdFALSE                 ((BaseType_t) 0)
+#define pdTRUE                  ((BaseType_t) 1)
+#define pdFAIL                  pdFALSE
+#define pdPASS                  pdTRUE
+#define errQUEUE_FULL           ((BaseType_t) 0)
+#define portMAX_DELAY           ((TickType_t) 0xffffffffUL)
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS      ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t) (((TickType_t) (ms) * configTICK_RATE_HZ) / 1000))
+#define portYIELD_FROM_ISR(...) do {} while (0)
+
+typedef void (*TaskFunction_t)(void*);
+typedef struct sim_task* TaskHandle_t;
+typedef struct sim_queue* QueueHandle_t;
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+// Semaphores are zero-sized queues, as in FreeRTOS proper.
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+
+#define xSemaphoreTake(sem, ticks)                 xQueueReceive(sem, nullptr, ticks)
+#define xSemaphoreGive(sem)                        xQueueSend(sem, nullptr, 0)
+#define xSemaphoreGiveFromISR(sem, woken)          xQueueSendFromISR(sem, nullptr, woken)
+#define vSemaphoreDelete(sem)                      vQueueDelete(sem)
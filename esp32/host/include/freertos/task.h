@@ -0,0 +1,18 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_depth,
+                       void* param, UBaseType_t priority, TaskHandle_t* handle);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth,
+                                   void* param, UBaseType_t priority, TaskHandle_t* handle,
+                                   BaseType_t core_id);
+
+void vTaskDelay(TickType_t ticks);
+
+void vTaskDelayUntil(TickType_t* previous_wake_time, TickType_t increment);
+
+TickType_t xTaskGetTickCount();
+
+TickType_t xTaskGetTickCountFromISR();
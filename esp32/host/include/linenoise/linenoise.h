@@ -0,0 +1,8 @@
+#pragma once
+
+char* linenoise(const char* prompt);
+void linenoiseFree(void* ptr);
+int linenoiseHistoryAdd(const char* line);
+int linenoiseHistorySetMaxLen(int len);
+void linenoiseSetMultiLine(int ml);
+void linenoiseSetDumbMode(int set);
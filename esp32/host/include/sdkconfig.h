@@ -0,0 +1,9 @@
+#pragma once
+
+// Host build: the subset of ../sdkconfig that the firmware sources refer to.
+
+#define CONFIG_IDF_TARGET "esp32"
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_ESP_CONSOLE_UART_NUM 0
+#define CONFIG_ESP_CONSOLE_UART_BAUDRATE 115200
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 160
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#include <chrono>
+#include <cstdint>
+
+// The host has no cycle counter running at the target's rate, so this
+// counts wall time in cycles of CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ.
+static inline uint32_t esp_cpu_get_ccount()
+{
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (uint32_t) (ns*CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ/1000);
+}
@@ -0,0 +1,48 @@
+// Host stand-in for linenoise in dumb mode: plain line reads from stdin.
+// The simulation ends when stdin does. Lines starting with '#' are skipped,
+// so that scripts can have comments.
+
+#include "sim.h"
+
+#include <linenoise/linenoise.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+char* linenoise(const char* prompt)
+{
+    fputs(prompt, stdout);
+    fflush(stdout);
+    char buf[256];
+    do
+    {
+        if (!fgets(buf, sizeof(buf), stdin))
+            sim_exit();
+    } while (buf[0] == '#');
+    buf[strcspn(buf, "\r\n")] = 0;
+    return strdup(buf);
+}
+
+void linenoiseFree(void* ptr)
+{
+    free(ptr);
+}
+
+int linenoiseHistoryAdd(const char*)
+{
+    return 1;
+}
+
+int linenoiseHistorySetMaxLen(int)
+{
+    return 1;
+}
+
+void linenoiseSetMultiLine(int)
+{
+}
+
+void linenoiseSetDumbMode(int)
+{
+}
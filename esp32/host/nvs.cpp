@@ -0,0 +1,135 @@
+// Host stand-in for NVS: an in-memory key/value store per namespace,
+// optionally backed by a text file with one "namespace key value" per line.
+
+#include "sim.h"
+
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace
+{
+
+std::mutex nvs_mutex;
+std::map<std::string, std::map<std::string, int32_t>> nvs_data;
+std::map<nvs_handle_t, std::string> nvs_handles;
+nvs_handle_t next_handle = 1;
+std::string nvs_file;
+
+// Called with nvs_mutex held
+void write_items(std::ostream& out)
+{
+    for (const auto& ns : nvs_data)
+        for (const auto& item : ns.second)
+            out << ns.first << ' ' << item.first << ' ' << item.second << '\n';
+}
+
+// Called with nvs_mutex held
+void save()
+{
+    if (nvs_file.empty())
+        return;
+    std::ofstream out(nvs_file);
+    write_items(out);
+}
+
+}
+
+void sim_nvs_set_file(const char* path)
+{
+    sim_nvs_load(path);
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_file = path;
+}
+
+void sim_nvs_load(const char* path)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    std::ifstream in(path);
+    std::string ns, key;
+    int32_t value;
+    while (in >> ns >> key >> value)
+        nvs_data[ns][key] = value;
+}
+
+bool sim_nvs_save(const char* path)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    std::ofstream out(path);
+    write_items(out);
+    return !!out;
+}
+
+esp_err_t nvs_flash_init()
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase()
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_data.clear();
+    save();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t, nvs_handle_t* out_handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    *out_handle = next_handle++;
+    nvs_handles[*out_handle] = name;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto h = nvs_handles.find(handle);
+    if (h == nvs_handles.end())
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    auto& ns = nvs_data[h->second];
+    auto it = ns.find(key);
+    if (it == ns.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+    *out_value = it->second;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto h = nvs_handles.find(handle);
+    if (h == nvs_handles.end())
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    nvs_data[h->second][key] = value;
+    save();
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto h = nvs_handles.find(handle);
+    if (h == nvs_handles.end())
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!nvs_data[h->second].erase(key))
+        return ESP_ERR_NVS_NOT_FOUND;
+    save();
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    return nvs_handles.count(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_handles.erase(handle);
+}
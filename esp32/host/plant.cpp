@@ -0,0 +1,387 @@
+#include "plant.h"
+#include "sim.h"
+
+#include "defines.h"
+
+#include <algorithm>
+#include <cmath>
+
+// The encoder is wired to this PCNT unit
+constexpr int ENCODER_UNIT = 0;
+
+// Model step
+constexpr int64_t STEP_US = 1000;
+
+// Speed (pulses/s) below which a motor that is not driven has stopped
+constexpr double MIN_SPEED = 1e-3;
+
+Plant& Plant::instance()
+{
+    static Plant plant;
+    return plant;
+}
+
+void Plant::configure(const Config& c)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    config = c;
+    motor = bolt = config.start_position;
+    encoder_pos = (long) std::floor(bolt);
+    speed = 0;
+}
+
+void Plant::set_friction(int duty_dead_zone)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    config.duty_dead_zone = duty_dead_zone;
+}
+
+void Plant::set_slack(double slack)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    config.slack = slack;
+}
+
+void Plant::start()
+{
+    sim_start_periodic("plant", STEP_US, [this]() { step(STEP_US/1e6); });
+}
+
+void Plant::step(double dt)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    const bool powered = standby && in1 != in2;
+    const bool braking = standby && in1 && in2;
+    const double half_slack = config.slack/2;
+    // At rest nothing changes until the motor is driven again
+    if (!powered && speed == 0)
+        return;
+
+    // Commanded speed along the encoder axis; forward (locking) counts down
+    double target = 0;
+    double tau = config.tau_coast;
+    if (powered)
+    {
+        const int sign = in1 ? -1 : 1;
+        target = sign * config.speed_per_duty * std::max(0, duty - config.duty_dead_zone);
+        const bool free = sign > 0 ? motor - bolt < half_slack : bolt - motor < half_slack;
+        if (free)
+            target *= config.free_speed_factor;
+        tau = config.tau_drive;
+        drive_us += dt*1e6;
+    }
+    else if (braking)
+        tau = config.tau_brake;
+
+    speed += (target - speed) * std::min(1.0, dt/tau);
+    if (!powered && std::abs(speed) < MIN_SPEED)
+        speed = 0;
+    motor += speed*dt;
+
+    // The bolt follows the motor once the slack has been taken up
+    double new_bolt = bolt;
+    if (motor - bolt > half_slack)
+        new_bolt = motor - half_slack;
+    else if (bolt - motor > half_slack)
+        new_bolt = motor + half_slack;
+    const double clamped = limit_bolt(new_bolt);
+    if (clamped != new_bolt)
+    {
+        // Pushing against an end stop or a jam
+        motor = clamped + (motor > clamped ? half_slack : -half_slack);
+        speed = 0;
+        if (powered)
+            stall_us += dt*1e6;
+    }
+    move_bolt_to(clamped);
+}
+
+double Plant::limit_bolt(double position) const
+{
+    double low = config.lock_stop;
+    double high = config.unlock_stop;
+    if (is_jammed)
+    {
+        if (bolt >= jam_position)
+            low = std::max(low, jam_position);
+        else
+            high = std::min(high, jam_position);
+    }
+    return std::min(std::max(position, low), high);
+}
+
+void Plant::move_bolt_to(double position)
+{
+    const double old_bolt = bolt;
+    bolt = position;
+    const long p = (long) std::floor(bolt) + encoder_offset;
+    while (encoder_pos != p)
+        count_step(p > encoder_pos ? 1 : -1);
+
+    for (size_t i = 0; i < triggers.size(); )
+    {
+        const double t = triggers[i].position;
+        if ((old_bolt < t && bolt >= t) || (old_bolt > t && bolt <= t))
+        {
+            auto action = std::move(triggers[i].action);
+            triggers.erase(triggers.begin() + i);
+            action();
+        }
+        else
+            ++i;
+    }
+}
+
+// Quadrature levels (A, B) for the encoder position modulo 4, in the
+// direction that the firmware's PCNT configuration counts up
+static const int QUADRATURE[4][2] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 0 } };
+
+static int quadrature_level(long pos, int channel)
+{
+    return QUADRATURE[pos & 3][channel];
+}
+
+void Plant::count_step(int dir)
+{
+    encoder_pos += dir;
+    if (missed_pulses > 0)
+    {
+        // The levels change, but the edges are lost
+        --missed_pulses;
+        return;
+    }
+    count_pcnt(dir);
+    const int changed = quadrature_level(encoder_pos, 0) != quadrature_level(encoder_pos - dir, 0) ? ENC_A : ENC_B;
+    input_changed(changed);
+}
+
+void Plant::count_pcnt(int dir)
+{
+    auto& u = pcnt[ENCODER_UNIT];
+    if (!u.running)
+        return;
+    u.count += dir;
+    uint32_t status = 0;
+    if (u.count == u.thres0)
+        status |= PCNT_EVT_THRES_0;
+    if (u.count == u.thres1)
+        status |= PCNT_EVT_THRES_1;
+    // Reaching a limit resets the counter whether or not the event is enabled
+    if (u.h_lim && u.count >= u.h_lim)
+    {
+        status |= PCNT_EVT_H_LIM;
+        u.count = 0;
+    }
+    else if (u.l_lim && u.count <= u.l_lim)
+    {
+        status |= PCNT_EVT_L_LIM;
+        u.count = 0;
+    }
+    if (u.count == 0)
+        status |= PCNT_EVT_ZERO;
+    status &= u.enabled;
+    if (status && u.isr)
+    {
+        u.status = status;
+        // The mutex is recursive, so the handler may call back into the plant
+        u.isr(u.isr_arg);
+    }
+}
+
+void Plant::set_gpio(int pin, int level)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (pin == AIN1)
+        in1 = level;
+    else if (pin == AIN2)
+        in2 = level;
+    else if (pin == STBY)
+        standby = level;
+    else if (pin == LED)
+        led = level;
+}
+
+int Plant::get_gpio(int pin)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    // Switches pull the (pulled-up) input low when active
+    if (pin == DOOR_SW)
+        return !door_closed;
+    if (pin == HANDLE_SW)
+        return !handle_raised;
+    if (pin == LED)
+        return led;
+    if (pin == ENC_A)
+        return quadrature_level(encoder_pos, 0);
+    if (pin == ENC_B)
+        return quadrature_level(encoder_pos, 1);
+    return 0;
+}
+
+void Plant::set_pwm(int pin, uint32_t d)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (pin == PWMA)
+        duty = (int) d;
+}
+
+void Plant::gpio_set_isr(int pin, void (*isr)(void*), void* arg)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    gpio_intr[pin].isr = isr;
+    gpio_intr[pin].arg = arg;
+}
+
+void Plant::gpio_enable_intr(int pin, bool enable)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    gpio_intr[pin].enabled = enable;
+}
+
+void Plant::input_changed(int pin)
+{
+    // All inputs interrupt on any edge
+    const auto& intr = gpio_intr[pin];
+    if (intr.enabled && intr.isr)
+        intr.isr(intr.arg);
+}
+
+void Plant::pcnt_config(int unit, int16_t h_lim, int16_t l_lim)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    pcnt[unit].h_lim = h_lim;
+    pcnt[unit].l_lim = l_lim;
+}
+
+void Plant::pcnt_set_running(int unit, bool running)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    pcnt[unit].running = running;
+}
+
+void Plant::pcnt_clear(int unit)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    pcnt[unit].count = 0;
+}
+
+int16_t Plant::pcnt_get_count(int unit)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return pcnt[unit].count;
+}
+
+void Plant::pcnt_enable_event(int unit, uint32_t event, bool enable)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (enable)
+        pcnt[unit].enabled |= event;
+    else
+        pcnt[unit].enabled &= ~event;
+}
+
+void Plant::pcnt_set_event_value(int unit, uint32_t event, int16_t value)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (event == PCNT_EVT_THRES_0)
+        pcnt[unit].thres0 = value;
+    else if (event == PCNT_EVT_THRES_1)
+        pcnt[unit].thres1 = value;
+    else if (event == PCNT_EVT_H_LIM)
+        pcnt[unit].h_lim = value;
+    else if (event == PCNT_EVT_L_LIM)
+        pcnt[unit].l_lim = value;
+}
+
+uint32_t Plant::pcnt_get_status(int unit)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return pcnt[unit].status;
+}
+
+void Plant::pcnt_set_isr(int unit, void (*isr)(void*), void* arg)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    pcnt[unit].isr = isr;
+    pcnt[unit].isr_arg = arg;
+}
+
+void Plant::set_door_closed(bool closed)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (door_closed == closed)
+        return;
+    door_closed = closed;
+    input_changed(DOOR_SW);
+}
+
+void Plant::set_handle_raised(bool raised)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (handle_raised == raised)
+        return;
+    handle_raised = raised;
+    input_changed(HANDLE_SW);
+}
+
+void Plant::turn(int pulses)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    const double new_bolt = limit_bolt(bolt + pulses);
+    // The gearbox is back-drivable, so the motor is dragged along
+    const double half_slack = config.slack/2;
+    if (motor - new_bolt > half_slack)
+        motor = new_bolt + half_slack;
+    else if (new_bolt - motor > half_slack)
+        motor = new_bolt - half_slack;
+    move_bolt_to(new_bolt);
+}
+
+void Plant::inject_pulses(int pulses)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    encoder_offset += pulses;
+    move_bolt_to(bolt);
+}
+
+void Plant::miss_pulses(int pulses)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    missed_pulses = pulses;
+}
+
+void Plant::jam(double position)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    is_jammed = true;
+    jam_position = position;
+}
+
+void Plant::clear_jam()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    is_jammed = false;
+}
+
+void Plant::at_bolt(double position, std::function<void()> action)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    triggers.push_back({ position, std::move(action) });
+}
+
+Plant::Snapshot Plant::snapshot()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Snapshot s;
+    s.motor = motor;
+    s.bolt = bolt;
+    s.speed = speed;
+    s.duty = (in1 != in2 && standby) ? duty : 0;
+    s.door_closed = door_closed;
+    s.handle_raised = handle_raised;
+    s.led = led;
+    s.drive_us = drive_us;
+    s.stall_us = stall_us;
+    return s;
+}
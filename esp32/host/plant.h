@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/// Stand-in for the lock mechanism and everything wired to it: the motor
+/// driver, a gearbox with dead-band slack, the bolt and its end stops, the
+/// quadrature encoder feeding the PCNT units, and the door/handle switches.
+///
+/// Positions are in encoder pulses. Positive motor power drives towards the
+/// locked end stop, which makes the encoder count down, as on the real door.
+class Plant
+{
+public:
+    struct Config
+    {
+        /// Bolt position at the locked end stop
+        double lock_stop = 0;
+        /// Bolt position at the unlocked end stop
+        double unlock_stop = 70;
+        /// Bolt position at power-up
+        double start_position = 45;
+        /// Dead band between motor and bolt
+        double slack = 6;
+        /// Loaded speed in pulses/s per unit of duty above the dead zone
+        double speed_per_duty = 0.035;
+        /// Duty below which the motor does not turn
+        int duty_dead_zone = 115;
+        /// Speed multiplier while the motor turns freely inside the slack
+        double free_speed_factor = 2;
+        /// Time constants (s) for reaching commanded speed, braking and coasting
+        double tau_drive = 0.02;
+        double tau_brake = 0.005;
+        double tau_coast = 0.1;
+    };
+
+    struct Snapshot
+    {
+        double motor = 0;
+        double bolt = 0;
+        double speed = 0;
+        int duty = 0;
+        bool door_closed = true;
+        bool handle_raised = true;
+        bool led = false;
+        /// Total time spent with the motor powered
+        int64_t drive_us = 0;
+        /// Total time spent powered against an end stop
+        int64_t stall_us = 0;
+    };
+
+    static Plant& instance();
+
+    void configure(const Config& config);
+
+    /// Change the load while running: the duty below which the motor does
+    /// not turn, and the dead band between motor and bolt.
+    void set_friction(int duty_dead_zone);
+    void set_slack(double slack);
+
+    /// Start stepping the model at 1 kHz, like a periodic interrupt.
+    void start();
+
+    /// Advance the model by 'dt' seconds.
+    void step(double dt);
+
+    // Peripheral side, called by the driver stand-ins
+
+    void set_gpio(int pin, int level);
+    int get_gpio(int pin);
+    void set_pwm(int pin, uint32_t duty);
+    void gpio_set_isr(int pin, void (*isr)(void*), void* arg);
+    void gpio_enable_intr(int pin, bool enable);
+
+    void pcnt_config(int unit, int16_t h_lim, int16_t l_lim);
+    void pcnt_set_running(int unit, bool running);
+    void pcnt_clear(int unit);
+    int16_t pcnt_get_count(int unit);
+    void pcnt_enable_event(int unit, uint32_t event, bool enable);
+    void pcnt_set_event_value(int unit, uint32_t event, int16_t value);
+    uint32_t pcnt_get_status(int unit);
+    void pcnt_set_isr(int unit, void (*isr)(void*), void* arg);
+
+    // Test side
+
+    void set_door_closed(bool closed);
+    void set_handle_raised(bool raised);
+
+    /// Turn the knob by hand. The bolt moves 'pulses', clamped at the end stops.
+    void turn(int pulses);
+
+    // Faults
+
+    /// Make the encoder count 'pulses' (signed) that the bolt did not move,
+    /// all at once, as electrical noise would.
+    void inject_pulses(int pulses);
+
+    /// Let the next 'pulses' encoder steps go uncounted.
+    void miss_pulses(int pulses);
+
+    /// Block the bolt at 'position', from whichever side it is on, until
+    /// clear_jam() is called.
+    void jam(double position);
+
+    void clear_jam();
+
+    /// Call 'action' once, from the model step, when the bolt reaches
+    /// 'position'. It must not wait.
+    void at_bolt(double position, std::function<void()> action);
+
+    Snapshot snapshot();
+
+private:
+    Plant() = default;
+
+    struct PcntUnit
+    {
+        bool running = false;
+        int16_t count = 0;
+        int16_t h_lim = 0;
+        int16_t l_lim = 0;
+        int16_t thres0 = 0;
+        int16_t thres1 = 0;
+        uint32_t enabled = 0;
+        uint32_t status = 0;
+        void (*isr)(void*) = nullptr;
+        void* isr_arg = nullptr;
+    };
+
+    struct GpioIntr
+    {
+        bool enabled = false;
+        void (*isr)(void*) = nullptr;
+        void* arg = nullptr;
+    };
+
+    void move_bolt_to(double position);
+    /// Clamp a new bolt position to the end stops and any jam
+    double limit_bolt(double position) const;
+    void input_changed(int pin);
+    void count_step(int dir);
+    void count_pcnt(int dir);
+
+    // Recursive so that PCNT handlers can call back into the plant
+    std::recursive_mutex mutex;
+    Config config;
+    double motor = 45;
+    double bolt = 45;
+    double speed = 0;
+    int in1 = 0;
+    int in2 = 0;
+    int standby = 0;
+    int duty = 0;
+    int led = 0;
+    bool door_closed = true;
+    bool handle_raised = true;
+    int64_t drive_us = 0;
+    int64_t stall_us = 0;
+    /// Bolt position as last seen by the encoder, in whole pulses
+    long encoder_pos = 45;
+    /// Pulses counted, net, without the bolt moving
+    long encoder_offset = 0;
+    int missed_pulses = 0;
+    bool is_jammed = false;
+    double jam_position = 0;
+    struct Trigger
+    {
+        double position;
+        std::function<void()> action;
+    };
+    std::vector<Trigger> triggers;
+    PcntUnit pcnt[8];
+    GpioIntr gpio_intr[40];
+};
@@ -0,0 +1,81 @@
+// Runs scenario scripts against the simulator and reports which pass.
+//
+//   run_scenarios <path to danalock_sim> <scenario>...
+//
+// A scenario is a console script, usually with sim_* commands that inject
+// faults and sim_expect commands that check the outcome (see sim_main.cpp).
+// Each one runs in a fresh simulator on the virtual clock, so it starts
+// from power-up and takes little wall time. A line
+//
+//   # args: <options>
+//
+// passes extra options to the simulator, e.g. a different travel with -t.
+// A line
+//
+//   # max_wall_ms: <ms>
+//
+// fails the scenario if it takes longer than that in wall time, to catch
+// the simulator itself getting slower.
+// A scenario passes if the simulator exits with status 0 in time. The output
+// of a failed scenario is printed. The exit status is the number of failures.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/wait.h>
+
+// Get what follows 'key' on the first line that starts with it
+static std::string get_header(const char* path, const char* key)
+{
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+        if (!line.compare(0, strlen(key), key))
+            return line.substr(strlen(key));
+    return "";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <danalock_sim> <scenario>...\n", argv[0]);
+        return 1;
+    }
+    int failures = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        const char* path = argv[i];
+        const auto command = std::string(argv[1]) + " -v" + get_header(path, "# args:") +
+            " < '" + path + "' 2>&1";
+        const auto start = std::chrono::steady_clock::now();
+        auto pipe = popen(command.c_str(), "r");
+        if (!pipe)
+        {
+            perror("popen");
+            return 1;
+        }
+        std::string output;
+        char buf[256];
+        while (fgets(buf, sizeof(buf), pipe))
+            output += buf;
+        const int status = pclose(pipe);
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        const auto max_ms = atoll(get_header(path, "# max_wall_ms:").c_str());
+        const bool is_slow = max_ms && ms > max_ms;
+        const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && !is_slow;
+        printf("%s %s (%lld ms%s)\n", ok ? "PASS" : "FAIL", path, (long long) ms,
+               is_slow ? ", too slow" : "");
+        if (!ok)
+        {
+            fputs(output.c_str(), stdout);
+            ++failures;
+        }
+    }
+    printf("%d of %d scenarios passed\n", argc - 2 - failures, argc - 2);
+    return failures;
+}
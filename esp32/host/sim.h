@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+/// Priorities of the threads standing in for the hardware and the esp_timer
+/// task, relative to the FreeRTOS task priorities
+constexpr int SIM_PLANT_PRIORITY = 100;
+constexpr int SIM_TIMER_PRIORITY = 22;
+
+/// Run on a virtual clock instead of wall time, so that waiting costs
+/// nothing and a run is repeatable. Call at the start of main(), before
+/// any thread is started; the calling thread becomes a simulated thread.
+/// Reading stdin does not advance the clock, so this is meant for scripted
+/// input.
+void sim_use_virtual_time();
+
+/// Start a thread that takes part in the simulation, at a FreeRTOS style
+/// 'priority'.
+void sim_thread_start(const char* name, int priority, std::function<void()> fn);
+
+/// Call 'fn' every 'period_us', as a hardware interrupt would. On the
+/// virtual clock it runs within the scheduler when the clock passes its
+/// time, before any thread due at the same time, and must not wait; on
+/// wall time it runs in a thread of its own.
+void sim_start_periodic(const char* name, int64_t period_us, std::function<void()> fn);
+
+/// Stop taking part in the simulation. The calling thread must no longer
+/// use the clock.
+void sim_thread_exit();
+
+/// Microseconds since the simulation started.
+int64_t sim_time_us();
+
+/// Block the calling thread until sim_time_us() has reached 'us'.
+void sim_sleep_until_us(int64_t us);
+
+/// Wait on 'cond' until notified or sim_time_us() reaches 'deadline_us'
+/// (-1 to wait indefinitely). Return false on timeout.
+bool sim_wait_until_us(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                       int64_t deadline_us);
+
+/// Wake the threads waiting on 'cond' in sim_wait_until_us().
+void sim_notify_all(std::condition_variable& cond);
+
+/// Record a failed expectation. The simulator then exits with status 1.
+void sim_fail();
+
+/// Whether sim_fail() has been called.
+bool sim_has_failed();
+
+/// End the simulation, with status 1 if sim_fail() has been called.
+[[noreturn]] void sim_exit();
+
+/// Keep the NVS contents in 'path', so that they survive a restart of the
+/// simulator. Call before app_main().
+void sim_nvs_set_file(const char* path);
+
+/// Read NVS contents from 'path', without keeping them there.
+void sim_nvs_load(const char* path);
+
+/// Write the NVS contents to 'path'. Return false on error.
+bool sim_nvs_save(const char* path);
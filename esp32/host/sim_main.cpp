@@ -0,0 +1,438 @@
+// Plant simulator: runs the firmware against the stand-in hardware layer.
+//
+// Commands are read from stdin exactly as from the serial console, and the
+// time taken by each is reported on stderr. In addition to the firmware
+// commands, the following control the simulated door:
+//
+//   sim_door <0|1>      open/close the door
+//   sim_handle <0|1>    lower/raise the handle
+//   sim_turn <pulses>   turn the knob by hand
+//   sim_wait <ms>       let time pass
+//   sim_state           print the state of the mechanism
+//   sim_restart [<pulses>]
+//                       power-cycle: run the simulator afresh on the rest of
+//                       the input, keeping NVS, the bolt position and the
+//                       switches. The knob is turned by <pulses> while off.
+//
+// and these inject faults:
+//
+//   sim_glitch <pulses>          count pulses without the bolt moving
+//   sim_miss <pulses>            do not count the next pulses
+//   sim_jam <position>|off       block the bolt at a position
+//   sim_bounce <door|handle> <0|1> <edges> <ms>
+//                                toggle a switch, ending in the given state
+//   sim_at <position> <command>  run a command when the bolt gets there
+//
+// and these check the outcome, for scenario scripts:
+//
+//   sim_mark                     start timing
+//   sim_expect state <state>     as printed by 'status'
+//   sim_expect calibrated <0|1>
+//   sim_expect bolt <min> <max>  where the bolt really is
+//   sim_expect position <min> <max>
+//                                where the firmware thinks it is
+//   sim_expect elapsed <max ms>  time since sim_mark
+//   sim_expect stall <max ms>    total time powered against a stop
+//   sim_expect duty <min> <max>  motor PWM duty, 0 when not driven
+//   sim_expect warning <0|1>     the auto-lock warning
+//
+// A failed expectation prints "FAIL: ..." and makes the simulator exit
+// with status 1 when the input ends.
+//
+// Example:
+//   printf 'calibrate\nwait\nlock\nwait\n' | ./danalock_sim
+//
+// With -n, NVS is kept in a file, so a reboot can be simulated by running
+// again with the same file and -p set to where the bolt was left, which is
+// what sim_restart does. Without -n, sim_restart hands NVS over in a
+// temporary file, given with -N. stdin is read unbuffered, so the new
+// simulator goes on with the next line. Faults injected are not kept, nor
+// is the time.
+//
+// With -v, time is virtual: waits take no wall time, so a script of many
+// commands runs much faster than real time, with the same result every
+// run. Commands are then read as fast as the console takes them, so
+// scripts should 'wait' for jobs, or use sim_wait, as they would in real
+// time.
+
+#include "plant.h"
+#include "sim.h"
+#include "status.h"
+
+#include <esp_console.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" void app_main();
+
+// Longer than the debounce time of the switches
+constexpr int SWITCH_SETTLE_MS = 50;
+
+static int sim_door(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    Plant::instance().set_door_closed(atoi(argv[1]));
+    return 0;
+}
+
+static int sim_handle(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    Plant::instance().set_handle_raised(atoi(argv[1]));
+    return 0;
+}
+
+static int sim_turn(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    Plant::instance().turn(atoi(argv[1]));
+    return 0;
+}
+
+static int sim_wait(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    vTaskDelay(atoi(argv[1])/portTICK_PERIOD_MS);
+    return 0;
+}
+
+static int sim_state(int, char**)
+{
+    const auto s = Plant::instance().snapshot();
+    printf("SIM: bolt %.2f motor %.2f speed %.2f duty %d door %s handle %s led %s drive %lld ms stall %lld ms\n",
+           s.bolt, s.motor, s.speed, s.duty,
+           s.door_closed ? "closed" : "open",
+           s.handle_raised ? "raised" : "lowered",
+           s.led ? "on" : "off",
+           (long long) s.drive_us/1000, (long long) s.stall_us/1000);
+    return 0;
+}
+
+static int sim_glitch(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    Plant::instance().inject_pulses(atoi(argv[1]));
+    return 0;
+}
+
+static int sim_miss(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    Plant::instance().miss_pulses(atoi(argv[1]));
+    return 0;
+}
+
+static int sim_jam(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+    if (!strcmp(argv[1], "off"))
+        Plant::instance().clear_jam();
+    else
+        Plant::instance().jam(atof(argv[1]));
+    return 0;
+}
+
+static int sim_bounce(int argc, char** argv)
+{
+    if (argc < 5)
+        return 1;
+    const bool is_door = !strcmp(argv[1], "door");
+    const bool final_state = atoi(argv[2]);
+    const int edges = atoi(argv[3]);
+    const int ms = atoi(argv[4]);
+    auto& plant = Plant::instance();
+    // Count back from the final state, so that the last edge lands on it
+    for (int i = edges; i > 0; --i)
+    {
+        const bool level = (i % 2) ? final_state : !final_state;
+        if (is_door)
+            plant.set_door_closed(level);
+        else
+            plant.set_handle_raised(level);
+        vTaskDelay(ms/portTICK_PERIOD_MS);
+    }
+    return 0;
+}
+
+static int sim_at(int argc, char** argv)
+{
+    if (argc < 3)
+        return 1;
+    std::string command;
+    for (int i = 2; i < argc; ++i)
+        command += std::string(i > 2 ? " " : "") + argv[i];
+    Plant::instance().at_bolt(atof(argv[1]), [command]()
+    {
+        int ret = 0;
+        esp_console_run(command.c_str(), &ret);
+    });
+    return 0;
+}
+
+static int64_t mark_us = 0;
+
+static int sim_mark(int, char**)
+{
+    mark_us = sim_time_us();
+    return 0;
+}
+
+static const char* state_name(State state)
+{
+    switch (state)
+    {
+    case Unknown: return "unknown";
+    case Locked: return "locked";
+    case Unlocked: return "unlocked";
+    case LockedManually: return "lockedmanually";
+    case UnlockedManually: return "unlockedmanually";
+    case ChangedManually: return "changedmanually";
+    }
+    return "?";
+}
+
+static void expect(bool ok, const char* what, const std::string& expected, const std::string& actual)
+{
+    if (ok)
+        return;
+    printf("FAIL: %s: expected %s, got %s\n", what, expected.c_str(), actual.c_str());
+    sim_fail();
+}
+
+static int sim_expect(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("FAIL: incomplete expectation\n");
+        sim_fail();
+        return 1;
+    }
+    const std::string what = argv[1];
+    const auto status = status_publisher.read();
+    const auto plant = Plant::instance().snapshot();
+    auto expect_range = [&](double actual)
+    {
+        if (argc < 4)
+        {
+            printf("FAIL: %s needs <min> <max>\n", argv[1]);
+            sim_fail();
+            return 1;
+        }
+        const double low = atof(argv[2]);
+        const double high = atof(argv[3]);
+        expect(actual >= low && actual <= high, argv[1],
+               std::string(argv[2]) + ".." + argv[3], std::to_string(actual));
+        return 0;
+    };
+    if (what == "state")
+        expect(!strcmp(argv[2], state_name(status.state)), argv[1], argv[2], state_name(status.state));
+    else if (what == "calibrated")
+        expect(status.is_calibrated == !!atoi(argv[2]), argv[1], argv[2], std::to_string(status.is_calibrated));
+    else if (what == "warning")
+        expect(status.warning == !!atoi(argv[2]), argv[1], argv[2], std::to_string(status.warning));
+    else if (what == "bolt")
+        return expect_range(plant.bolt);
+    else if (what == "position")
+        return expect_range(status.position);
+    else if (what == "duty")
+        return expect_range(plant.duty);
+    else if (what == "elapsed")
+    {
+        const auto ms = (sim_time_us() - mark_us)/1000;
+        expect(ms <= atoi(argv[2]), argv[1], std::string("<= ") + argv[2] + " ms", std::to_string(ms) + " ms");
+    }
+    else if (what == "stall")
+    {
+        const auto ms = plant.stall_us/1000;
+        expect(ms <= atoi(argv[2]), argv[1], std::string("<= ") + argv[2] + " ms", std::to_string(ms) + " ms");
+    }
+    else
+    {
+        printf("FAIL: unknown expectation '%s'\n", argv[1]);
+        sim_fail();
+        return 1;
+    }
+    return 0;
+}
+
+// What the simulator was started with, for sim_restart
+static struct
+{
+    Plant::Config config;
+    const char* nvs_file = nullptr;
+    bool is_virtual = false;
+    std::string argv0;
+} options;
+
+static int sim_restart(int argc, char** argv)
+{
+    fflush(stdout);
+    if (sim_has_failed())
+    {
+        printf("FAIL: not restarting after a failure\n");
+        sim_exit();
+    }
+    const auto s = Plant::instance().snapshot();
+    const auto& config = options.config;
+    const double bolt = std::min(std::max(s.bolt + (argc > 1 ? atoi(argv[1]) : 0),
+                                          config.lock_stop), config.unlock_stop);
+    std::vector<std::string> args = {
+        options.argv0,
+        "-t", std::to_string(config.unlock_stop - config.lock_stop),
+        "-p", std::to_string(bolt - config.lock_stop),
+        "-s", std::to_string(config.slack),
+    };
+    if (options.nvs_file)
+        args.insert(args.end(), { "-n", options.nvs_file });
+    else
+    {
+        char path[] = "/tmp/danalock_nvs_XXXXXX";
+        const int fd = mkstemp(path);
+        if (fd < 0 || !sim_nvs_save(path))
+        {
+            printf("FAIL: cannot save NVS for the restart\n");
+            sim_fail();
+            sim_exit();
+        }
+        close(fd);
+        args.insert(args.end(), { "-N", path });
+    }
+    if (!s.door_closed)
+        args.push_back("-d");
+    if (!s.handle_raised)
+        args.push_back("-l");
+    if (options.is_virtual)
+        args.push_back("-v");
+    std::vector<char*> new_argv;
+    for (auto& a : args)
+        new_argv.push_back(&a[0]);
+    new_argv.push_back(nullptr);
+    fflush(stderr);
+    execv("/proc/self/exe", new_argv.data());
+    perror("execv");
+    sim_fail();
+    sim_exit();
+}
+
+static void register_sim_commands()
+{
+    const esp_console_cmd_t cmds[] = {
+        { "sim_door", "Open (0) or close (1) the door", nullptr, &sim_door, nullptr },
+        { "sim_handle", "Lower (0) or raise (1) the handle", nullptr, &sim_handle, nullptr },
+        { "sim_turn", "Turn the knob by <pulses>", nullptr, &sim_turn, nullptr },
+        { "sim_wait", "Wait <ms>", nullptr, &sim_wait, nullptr },
+        { "sim_state", "Show mechanism state", nullptr, &sim_state, nullptr },
+        { "sim_restart", "Power-cycle, turning the knob by [pulses] meanwhile", nullptr, &sim_restart, nullptr },
+        { "sim_glitch", "Count <pulses> without moving", nullptr, &sim_glitch, nullptr },
+        { "sim_miss", "Do not count the next <pulses>", nullptr, &sim_miss, nullptr },
+        { "sim_jam", "Block the bolt at <position>, or 'off'", nullptr, &sim_jam, nullptr },
+        { "sim_bounce", "Bounce <door|handle> into <0|1> with <edges> <ms> apart", nullptr, &sim_bounce, nullptr },
+        { "sim_at", "Run <command> when the bolt reaches <position>", nullptr, &sim_at, nullptr },
+        { "sim_mark", "Start timing for 'sim_expect elapsed'", nullptr, &sim_mark, nullptr },
+        { "sim_expect", "Check <state|calibrated|warning|bolt|position|elapsed|stall|duty> <value...>", nullptr, &sim_expect, nullptr },
+    };
+    for (const auto& cmd : cmds)
+        ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-t travel] [-p start] [-s slack] [-n nvs_file] [-N nvs_file] [-d] [-l] [-v]\n"
+            "  -t  pulses between the end stops\n"
+            "  -p  initial bolt position (0 = locked end stop)\n"
+            "  -s  gearbox dead band in pulses\n"
+            "  -n  file to keep NVS contents in\n"
+            "  -N  file to read NVS contents from, and then delete\n"
+            "  -d  start with the door open\n"
+            "  -l  start with the handle lowered\n"
+            "  -v  run on a virtual clock\n",
+            argv0);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    auto& config = options.config;
+    options.argv0 = argv[0];
+    bool is_door_open = false;
+    bool is_handle_lowered = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:p:s:n:N:dlvh")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            config.unlock_stop = config.lock_stop + atof(optarg);
+            break;
+        case 'p':
+            config.start_position = config.lock_stop + atof(optarg);
+            break;
+        case 's':
+            config.slack = atof(optarg);
+            break;
+        case 'n':
+            options.nvs_file = optarg;
+            sim_nvs_set_file(optarg);
+            break;
+        case 'N':
+            sim_nvs_load(optarg);
+            unlink(optarg);
+            break;
+        case 'd':
+            is_door_open = true;
+            break;
+        case 'l':
+            is_handle_lowered = true;
+            break;
+        case 'v':
+            options.is_virtual = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (config.start_position > config.unlock_stop)
+        usage(argv[0]);
+
+    if (options.is_virtual)
+        sim_use_virtual_time();
+
+    auto& plant = Plant::instance();
+    plant.configure(config);
+    register_sim_commands();
+    plant.start();
+    if (is_door_open || is_handle_lowered)
+    {
+        // The switch driver is set up before main(), so it sees these as
+        // edges; let them settle before the firmware starts, as they would
+        // have at power-up
+        plant.set_door_closed(!is_door_open);
+        plant.set_handle_raised(!is_handle_lowered);
+        vTaskDelay(SWITCH_SETTLE_MS/portTICK_PERIOD_MS);
+    }
+
+    app_main();
+    sim_thread_exit();
+
+    // The firmware tasks run until stdin is exhausted
+    while (true)
+        std::this_thread::sleep_for(std::chrono::hours(1));
+}
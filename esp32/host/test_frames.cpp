@@ -0,0 +1,316 @@
+// Talks to the simulator with the framed protocol and checks the replies.
+//
+//   test_frames <path to danalock_sim>
+//
+// Runs the simulator on the virtual clock with its console on a pair of
+// pipes, sends frames and text commands, and decodes the output with
+// FrameDecoder. Covers the replies to each kind of request, malformed
+// frames, and the events sent when the door and handle change. Prints
+// "FAIL: ..." for each check that fails, and then the text output of the
+// simulator; the exit status is the number of failures.
+
+#include "frame_codec.h"
+
+#include "defines.h"
+#include "events.h"
+#include "job_queue.h"
+#include "status.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// How long to wait for a reply before giving up
+static constexpr int REPLY_TIMEOUT_MS = 10000;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (ok)
+        return;
+    printf("FAIL: %s\n", what);
+    ++failures;
+}
+
+class Simulator
+{
+public:
+    explicit Simulator(const char* path)
+    {
+        int input[2];
+        int output[2];
+        if (pipe(input) || pipe(output))
+        {
+            perror("pipe");
+            exit(1);
+        }
+        pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            dup2(input[0], STDIN_FILENO);
+            dup2(output[1], STDOUT_FILENO);
+            dup2(output[1], STDERR_FILENO);
+            close(input[0]);
+            close(input[1]);
+            close(output[0]);
+            close(output[1]);
+            execl(path, path, "-v", (char*) nullptr);
+            perror(path);
+            _exit(2);
+        }
+        close(input[0]);
+        close(output[1]);
+        to_sim = input[1];
+        from_sim = output[0];
+    }
+
+    void send(const std::vector<uint8_t>& bytes)
+    {
+        if (write(to_sim, bytes.data(), bytes.size()) != (ssize_t) bytes.size())
+            check(false, "write to the simulator");
+    }
+
+    void send_line(const std::string& line)
+    {
+        const auto text = line + "\n";
+        send(std::vector<uint8_t>(text.begin(), text.end()));
+    }
+
+    /// Send a request with the next sequence number.
+    uint8_t send_request(uint8_t command, const std::vector<uint8_t>& payload = {})
+    {
+        Frame frame;
+        frame.command = command;
+        frame.sequence = ++sequence;
+        for (auto b : payload)
+            frame.put_u8(b);
+        send(frame_encode(frame));
+        return frame.sequence;
+    }
+
+    /// Wait for the reply to request 'seq'. Return false on timeout. Events
+    /// received meanwhile are kept.
+    bool wait_reply(uint8_t seq, Frame& reply)
+    {
+        while (true)
+        {
+            while (decoder.next(reply))
+            {
+                if (reply.command == FRAME_EVENT)
+                    events.push_back(reply);
+                else if (reply.command & FRAME_REPLY && reply.sequence == seq)
+                    return true;
+            }
+            if (!receive())
+                return false;
+        }
+    }
+
+    /// Send a request and return its reply, or a frame with no command on
+    /// timeout.
+    Frame request(uint8_t command, const std::vector<uint8_t>& payload = {})
+    {
+        Frame reply;
+        if (!wait_reply(send_request(command, payload), reply))
+        {
+            check(false, "reply in time");
+            reply = Frame();
+        }
+        return reply;
+    }
+
+    /// Close the console and return the exit status of the simulator.
+    int finish()
+    {
+        close(to_sim);
+        while (receive())
+            ;
+        close(from_sim);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return status;
+    }
+
+    const FrameDecoder& get_decoder() const
+    {
+        return decoder;
+    }
+
+    /// FRAME_EVENTs received so far, oldest first
+    std::vector<Frame> events;
+
+private:
+    // Read what the simulator has sent. Return false on timeout or EOF.
+    bool receive()
+    {
+        pollfd pfd = { from_sim, POLLIN, 0 };
+        if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0)
+            return false;
+        uint8_t buf[256];
+        const auto n = read(from_sim, buf, sizeof(buf));
+        if (n <= 0)
+            return false;
+        decoder.feed(buf, n);
+        return true;
+    }
+
+    pid_t pid = -1;
+    int to_sim = -1;
+    int from_sim = -1;
+    uint8_t sequence = 0;
+    FrameDecoder decoder;
+};
+
+static bool is_reply(const Frame& reply, uint8_t command, FrameResult result, uint8_t length)
+{
+    return reply.command == (command | FRAME_REPLY) && reply.length == length &&
+        reply.payload[0] == result;
+}
+
+static uint8_t get_job_status(Simulator& sim, uint32_t id)
+{
+    Frame request;
+    request.put_u32(id);
+    const auto reply = sim.request(FRAME_JOB_STATUS,
+                                   std::vector<uint8_t>(request.payload,
+                                                        request.payload + request.length));
+    check(is_reply(reply, FRAME_JOB_STATUS, FRAME_OK, 2), "job_status reply");
+    return reply.payload[1];
+}
+
+// Run a motion command and check that it finishes
+static void run_job(Simulator& sim, uint8_t command, const char* what)
+{
+    const auto reply = sim.request(command);
+    check(is_reply(reply, command, FRAME_OK, 5), what);
+    const auto id = reply.get_u32(1);
+    check(id != 0, "job id");
+    const auto queued = get_job_status(sim, id);
+    check(queued == JobQueue::Queued || queued == JobQueue::Running, "job queued");
+    // The console takes the next frame once the job is done
+    sim.send_line("wait");
+    check(get_job_status(sim, id) == JobQueue::Done, "job done");
+}
+
+static void test_ping(Simulator& sim)
+{
+    const auto seq = sim.send_request(FRAME_PING);
+    Frame reply;
+    check(sim.wait_reply(seq, reply) && is_reply(reply, FRAME_PING, FRAME_OK, 1), "ping");
+}
+
+static void test_status(Simulator& sim, State state, bool is_calibrated)
+{
+    const auto reply = sim.request(FRAME_STATUS);
+    check(is_reply(reply, FRAME_STATUS, FRAME_OK, 11), "status reply");
+    check(reply.payload[1] == state, "status state");
+    const uint8_t flags = FRAME_STATUS_DOOR_CLOSED | FRAME_STATUS_HANDLE_RAISED |
+        (is_calibrated ? FRAME_STATUS_CALIBRATED : 0);
+    check(reply.payload[2] == flags, "status flags");
+}
+
+static void test_bad_frames(Simulator& sim)
+{
+    // A ping with a corrupted CRC
+    Frame frame;
+    frame.command = FRAME_PING;
+    frame.sequence = 200;
+    auto bytes = frame_encode(frame);
+    bytes.back() ^= 0x01;
+    sim.send(bytes);
+    Frame reply;
+    check(sim.wait_reply(200, reply) && is_reply(reply, FRAME_PING, FRAME_BAD_CRC, 1), "bad crc");
+
+    // A length above FRAME_MAX_PAYLOAD is answered after the header
+    sim.send({ FRAME_SYNC, FRAME_MAX_PAYLOAD + 1, FRAME_PING, 201 });
+    check(sim.wait_reply(201, reply) && is_reply(reply, FRAME_PING, FRAME_BAD_LENGTH, 1),
+          "bad length");
+
+    const auto unknown = sim.request(0x7F);
+    check(is_reply(unknown, 0x7F, FRAME_UNKNOWN_COMMAND, 1), "unknown command");
+
+    // Still in step afterwards
+    test_ping(sim);
+}
+
+// The value of the last event of 'kind', or -1 if there was none
+static int get_last_event(const Simulator& sim, EventKind kind)
+{
+    for (auto e = sim.events.rbegin(); e != sim.events.rend(); ++e)
+        if (e->length == 10 && e->payload[0] == kind)
+            return e->payload[1];
+    return -1;
+}
+
+// Toggle the door and the handle, and turn the knob from unlocked to
+// locked, faster than events are sent: changes are merged, but the last
+// event of each kind has the final value
+static void test_events(Simulator& sim)
+{
+    const uint8_t all = EVENT_STATE | EVENT_DOOR | EVENT_HANDLE | EVENT_WARNING;
+    auto reply = sim.request(FRAME_EVENTS, { all });
+    check(is_reply(reply, FRAME_EVENTS, FRAME_OK, 5), "events reply");
+    const auto merged = reply.get_u32(1);
+
+    // Apart by more than the debounce time, so that every edge counts
+    const auto ms = std::to_string(EVENT_INTERVAL_MS/3);
+    sim.send_line("sim_bounce door 1 9 " + ms);
+    sim.send_line("sim_turn -15");
+    sim.send_line("sim_bounce handle 0 9 " + ms);
+    sim.send_line("sim_turn -15");
+    sim.send_line("sim_wait " + std::to_string(20*EVENT_INTERVAL_MS));
+    reply = sim.request(FRAME_EVENTS, { all });
+    check(is_reply(reply, FRAME_EVENTS, FRAME_OK, 5), "events reply");
+    check(reply.get_u32(1) > merged, "changes merged");
+
+    // The door ends up closed and the handle lowered
+    check(get_last_event(sim, EVENT_DOOR) == 1, "last door event");
+    check(get_last_event(sim, EVENT_HANDLE) == 0, "last handle event");
+    reply = sim.request(FRAME_STATUS);
+    check(is_reply(reply, FRAME_STATUS, FRAME_OK, 11), "status reply");
+    // Locked by hand with the door opened since: calibration is needed
+    check(reply.payload[1] == Unknown, "status state");
+    check(get_last_event(sim, EVENT_STATE) == Unknown, "last state event");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <danalock_sim>\n", argv[0]);
+        return 1;
+    }
+    // A simulator that has died shows up as missing replies
+    signal(SIGPIPE, SIG_IGN);
+    Simulator sim(argv[1]);
+
+    test_ping(sim);
+    test_status(sim, Unknown, false);
+    run_job(sim, FRAME_CALIBRATE, "calibrate reply");
+    test_status(sim, Unlocked, true);
+    run_job(sim, FRAME_LOCK, "lock reply");
+    test_status(sim, Locked, true);
+    test_bad_frames(sim);
+    run_job(sim, FRAME_UNLOCK, "unlock reply");
+    test_status(sim, Unlocked, true);
+    test_events(sim);
+
+    const auto status = sim.finish();
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "simulator exit status");
+    check(sim.get_decoder().get_errors() == 0, "no garbled frames");
+    if (failures)
+        fputs(sim.get_decoder().get_text().c_str(), stdout);
+    printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+    return failures;
+}
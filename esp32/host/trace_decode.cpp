@@ -0,0 +1,114 @@
+// Decodes motion traces dumped by the 'trace <n>' console command into CSV.
+//
+//   trace_decode < console.log > traces.csv
+//
+// Reads the console output from stdin, picks out the "TRACE: " lines and
+// writes one row per sample:
+//   job,operation,time_ms,position,power,door_closed,handle_raised,controlled
+// Anything else in the input is ignored, so a whole session log can be fed in.
+
+#include "motion_trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char PREFIX[] = "TRACE: ";
+
+static int decode_char(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '+')
+        return 62;
+    if (c == '/')
+        return 63;
+    return -1;
+}
+
+// Append the bytes encoded by 'text' to 'out'. Return false on bad input.
+static bool decode_base64(const std::string& text, std::vector<uint8_t>& out)
+{
+    uint32_t bits = 0;
+    int nbits = 0;
+    for (char c : text)
+    {
+        if (c == '=')
+            break;
+        const int value = decode_char(c);
+        if (value < 0)
+            return false;
+        bits = (bits << 6) | value;
+        nbits += 6;
+        if (nbits >= 8)
+        {
+            nbits -= 8;
+            out.push_back((bits >> nbits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    std::vector<uint8_t> data;
+    char buf[256];
+    int line_no = 0;
+    while (fgets(buf, sizeof(buf), stdin))
+    {
+        ++line_no;
+        // Tolerate CRLF and anything the terminal put before the prefix
+        const char* p = strstr(buf, PREFIX);
+        if (!p)
+            continue;
+        std::string text(p + strlen(PREFIX));
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+            text.pop_back();
+        if (!decode_base64(text, data))
+            fprintf(stderr, "line %d: bad base64\n", line_no);
+    }
+
+    printf("job,operation,time_ms,position,power,door_closed,handle_raised,controlled\n");
+    size_t pos = 0;
+    int traces = 0;
+    while (pos + sizeof(MotionTrace::Header) <= data.size())
+    {
+        MotionTrace::Header header;
+        memcpy(&header, &data[pos], sizeof(header));
+        if (header.magic[0] != 'T' || header.magic[1] != 'R' ||
+            header.version != MotionTrace::FORMAT_VERSION)
+        {
+            // Resynchronise on the next header
+            ++pos;
+            continue;
+        }
+        pos += sizeof(header);
+        ++traces;
+        if (header.lost)
+            fprintf(stderr, "job %u: first %u samples lost\n",
+                    (unsigned) header.job_id, (unsigned) header.lost);
+        unsigned i = 0;
+        for (; i < header.count && pos + sizeof(MotionTrace::Sample) <= data.size(); ++i)
+        {
+            MotionTrace::Sample s;
+            memcpy(&s, &data[pos], sizeof(s));
+            pos += sizeof(s);
+            printf("%u,%c,%u,%d,%d,%d,%d,%d\n",
+                   (unsigned) header.job_id, header.operation,
+                   (unsigned) s.time_ms, s.position, s.power,
+                   !!(s.flags & MotionTrace::DOOR_CLOSED),
+                   !!(s.flags & MotionTrace::HANDLE_RAISED),
+                   !!(s.flags & MotionTrace::CONTROLLED));
+        }
+        if (i < header.count)
+            fprintf(stderr, "job %u: truncated after %u of %u samples\n",
+                    (unsigned) header.job_id, i, (unsigned) header.count);
+    }
+    fprintf(stderr, "%d traces\n", traces);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "auto_lock.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <utility>
+
+#include <nvs.h>
+
+// Keys for NVS (keep short)
+static constexpr const char* LOCK_DELAY_KEY =     "al_lock_s";
+static constexpr const char* WARN_DELAY_KEY =     "al_warn_s";
+static constexpr const char* POSTPONE_KEY =       "al_postpone_s";
+
+void AutoLock::load()
+{
+    auto params = get_params();
+    nvs_handle my_handle;
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &my_handle));
+    const std::pair<const char*, int32_t*> items[] = {
+        { LOCK_DELAY_KEY, &params.lock_delay_s },
+        { WARN_DELAY_KEY, &params.warn_delay_s },
+        { POSTPONE_KEY, &params.postpone_s }
+    };
+    for (const auto& item : items)
+    {
+        const auto err = nvs_get_i32(my_handle, item.first, item.second);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+            printf("%s: NVS error %d\n", item.first, err);
+    }
+    nvs_close(my_handle);
+    m_lock_delay_s = params.lock_delay_s;
+    m_warn_delay_s = params.warn_delay_s;
+    m_postpone_s = params.postpone_s;
+}
+
+void AutoLock::set_params(const Params& params)
+{
+    m_lock_delay_s = params.lock_delay_s;
+    m_warn_delay_s = params.warn_delay_s;
+    m_postpone_s = params.postpone_s;
+
+    nvs_handle my_handle;
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &my_handle));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, LOCK_DELAY_KEY, params.lock_delay_s));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, WARN_DELAY_KEY, params.warn_delay_s));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, POSTPONE_KEY, params.postpone_s));
+    ESP_ERROR_CHECK(nvs_commit(my_handle));
+    nvs_close(my_handle);
+}
+
+AutoLock::Params AutoLock::get_params() const
+{
+    Params params;
+    params.lock_delay_s = m_lock_delay_s;
+    params.warn_delay_s = m_warn_delay_s;
+    params.postpone_s = m_postpone_s;
+    return params;
+}
+
+bool AutoLock::update(const StatusSnapshot& s,
+                      int64_t door_change_time_us, int64_t handle_change_time_us)
+{
+    const auto now = s.time_us;
+    const bool postpone = m_postpone_requested.exchange(false);
+    const bool is_locked = s.state == Locked || s.state == LockedManually;
+
+    // Only closing the door or raising the handle while unlocked starts the
+    // lock delay, or unlocking with the handle up would be undone at once
+    const bool is_shut = s.door_closed && s.handle_raised;
+    if (!is_locked && s.is_calibrated && is_shut && m_has_last && !m_was_shut)
+    {
+        m_shut_time_us = std::max(door_change_time_us, handle_change_time_us);
+        m_is_lock_pending = true;
+    }
+    if (is_locked || !s.is_calibrated || !is_shut)
+        m_is_lock_pending = false;
+    m_was_shut = is_shut;
+    m_has_last = true;
+
+    if (is_locked)
+    {
+        m_unlocked_time_us = -1;
+        m_postponed_until_us = 0;
+        m_warning = false;
+        return false;
+    }
+    if (m_unlocked_time_us < 0)
+        m_unlocked_time_us = now;
+    if (postpone)
+        m_postponed_until_us = now + m_postpone_s*1000000LL;
+    const int64_t warn_delay_s = m_warn_delay_s;
+    m_warning = warn_delay_s >= 0 &&
+        now >= std::max<int64_t>(m_unlocked_time_us + warn_delay_s*1000000LL, m_postponed_until_us);
+
+    const int64_t lock_delay_s = m_lock_delay_s;
+    if (!m_is_lock_pending || lock_delay_s < 0 || now - m_shut_time_us < lock_delay_s*1000000LL)
+        return false;
+    // Tried once; if it fails, the handle must be lowered and raised again
+    m_is_lock_pending = false;
+    return true;
+}
+
+void AutoLock::postpone()
+{
+    m_postpone_requested = true;
+}
+
+bool AutoLock::is_warning() const
+{
+    return m_warning;
+}
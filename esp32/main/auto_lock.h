@@ -0,0 +1,68 @@
+#pragma once
+
+#include "status.h"
+
+#include <atomic>
+#include <cstdint>
+
+/// The door rules of usecases.rst, run by the firmware so that they do not
+/// depend on a host:
+///
+/// - When the door is closed and the handle raised while unlocked, lock
+///   once this has lasted 'lock_delay_s'.
+/// - When the lock has been unlocked for 'warn_delay_s', warn until it is
+///   locked. The Open button (postpone()) ends the warning and puts it off
+///   for 'postpone_s'.
+///
+/// The parameters are kept in NVS. Only the motion task may call update(),
+/// which it does at every status refresh.
+class AutoLock
+{
+public:
+    struct Params
+    {
+        /// Seconds from door closed and handle raised to locking, -1 for never
+        int32_t lock_delay_s = -1;
+        /// Seconds unlocked before warning, -1 for never
+        int32_t warn_delay_s = 15*60;
+        /// Seconds the Open button puts the warning off
+        int32_t postpone_s = 15*60;
+    };
+
+    /// Load the parameters from NVS, where set.
+    void load();
+
+    /// Use 'params' and save them to NVS.
+    void set_params(const Params& params);
+
+    Params get_params() const;
+
+    /// Act on a newly published snapshot. Return true if a lock should be
+    /// started now.
+    bool update(const StatusSnapshot& snapshot,
+                int64_t door_change_time_us, int64_t handle_change_time_us);
+
+    /// End the warning, if any, and put it off. Callable from any task.
+    void postpone();
+
+    bool is_warning() const;
+
+private:
+    std::atomic<int32_t> m_lock_delay_s{Params().lock_delay_s};
+    std::atomic<int32_t> m_warn_delay_s{Params().warn_delay_s};
+    std::atomic<int32_t> m_postpone_s{Params().postpone_s};
+    std::atomic<bool> m_postpone_requested{false};
+    std::atomic<bool> m_warning{false};
+    /// When the lock was last seen to be unlocked, or -1 while locked
+    int64_t m_unlocked_time_us = -1;
+    /// Set by postpone()
+    int64_t m_postponed_until_us = 0;
+    bool m_has_last = false;
+    /// Door closed and handle raised at the last update
+    bool m_was_shut = false;
+    /// When the door was shut while unlocked, if it is to be locked
+    bool m_is_lock_pending = false;
+    int64_t m_shut_time_us = 0;
+};
+
+extern AutoLock auto_lock;
@@ -0,0 +1,130 @@
+#include "calibration.h"
+
+#include <stdio.h>
+#include <utility>
+
+#include <esp_attr.h>
+#include <nvs.h>
+
+// Keys for NVS (keep short)
+static constexpr const char* LOCKED_POSITION_KEY =   "locked_pos";
+static constexpr const char* UNLOCKED_POSITION_KEY = "unlocked_pos";
+static constexpr const char* MAXIMUM_POSITION_KEY =  "max_pos";
+static constexpr const char* POSITION_KEY =          "position";
+
+static constexpr uint32_t RTC_MAGIC = 0xDA10C4ED;
+
+struct RtcCalibration
+{
+    uint32_t magic;
+    Calibration cal;
+    uint32_t checksum;
+};
+
+// Not touched by the startup code, so this survives a software reset,
+// watchdog or brownout
+RTC_NOINIT_ATTR static RtcCalibration rtc_calibration;
+
+static uint32_t get_checksum(const Calibration& cal)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    const auto p = reinterpret_cast<const uint8_t*>(&cal);
+    for (size_t i = 0; i < sizeof(cal); ++i)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static void save_to_rtc(const Calibration& cal)
+{
+    rtc_calibration.magic = RTC_MAGIC;
+    rtc_calibration.cal = cal;
+    rtc_calibration.checksum = get_checksum(cal);
+}
+
+void save_calibration(const Calibration& cal)
+{
+    save_to_rtc(cal);
+
+    nvs_handle my_handle;
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &my_handle));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, LOCKED_POSITION_KEY, cal.locked_position));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, UNLOCKED_POSITION_KEY, cal.unlocked_position));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, MAXIMUM_POSITION_KEY, cal.maximum_position));
+    ESP_ERROR_CHECK(nvs_set_i32(my_handle, POSITION_KEY, cal.position));
+    ESP_ERROR_CHECK(nvs_commit(my_handle));
+    nvs_close(my_handle);
+}
+
+void save_position(int32_t position, bool to_nvs)
+{
+    if (rtc_calibration.magic == RTC_MAGIC && rtc_calibration.cal.position != position)
+    {
+        auto cal = rtc_calibration.cal;
+        cal.position = position;
+        save_to_rtc(cal);
+    }
+    if (!to_nvs)
+        return;
+
+    nvs_handle my_handle;
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &my_handle));
+    int32_t old_position = 0;
+    // Do not wear the flash if nothing has changed
+    if (nvs_get_i32(my_handle, POSITION_KEY, &old_position) != ESP_OK || old_position != position)
+    {
+        ESP_ERROR_CHECK(nvs_set_i32(my_handle, POSITION_KEY, position));
+        ESP_ERROR_CHECK(nvs_commit(my_handle));
+    }
+    nvs_close(my_handle);
+}
+
+bool load_calibration(Calibration& cal)
+{
+    if (rtc_calibration.magic == RTC_MAGIC &&
+        rtc_calibration.checksum == get_checksum(rtc_calibration.cal))
+    {
+        cal = rtc_calibration.cal;
+        return true;
+    }
+
+    nvs_handle my_handle;
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &my_handle));
+    const std::pair<const char*, int32_t*> items[] = {
+        { LOCKED_POSITION_KEY, &cal.locked_position },
+        { UNLOCKED_POSITION_KEY, &cal.unlocked_position },
+        { MAXIMUM_POSITION_KEY, &cal.maximum_position },
+        { POSITION_KEY, &cal.position }
+    };
+    bool ok = true;
+    for (const auto& item : items)
+    {
+        const auto err = nvs_get_i32(my_handle, item.first, item.second);
+        if (err != ESP_OK)
+        {
+            if (err != ESP_ERR_NVS_NOT_FOUND)
+                printf("%s: NVS error %d\n", item.first, err);
+            ok = false;
+            break;
+        }
+    }
+    nvs_close(my_handle);
+    if (ok)
+        save_to_rtc(cal);
+    return ok;
+}
+
+void erase_calibration()
+{
+    rtc_calibration.magic = 0;
+
+    nvs_handle my_handle;
+    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &my_handle));
+    // Without the locked position the rest is useless
+    const auto err = nvs_erase_key(my_handle, LOCKED_POSITION_KEY);
+    if (err == ESP_OK)
+        ESP_ERROR_CHECK(nvs_commit(my_handle));
+    else if (err != ESP_ERR_NVS_NOT_FOUND)
+        ESP_ERROR_CHECK(err);
+    nvs_close(my_handle);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+/// Calibration results and the bolt position, kept across resets
+struct Calibration
+{
+    int32_t locked_position = 0;
+    int32_t unlocked_position = 0;
+    int32_t maximum_position = 0;
+    /// Encoder position when last saved
+    int32_t position = 0;
+};
+
+/// Save to NVS and RTC memory.
+void save_calibration(const Calibration& cal);
+
+/// Update the saved position. NVS is only written if 'to_nvs' is set, as
+/// RTC memory is cheap to write but flash is not.
+void save_position(int32_t position, bool to_nvs);
+
+/// Load the saved calibration. RTC memory, which survives any reset except
+/// power-on, is newer and preferred over NVS. Return false if there is none.
+bool load_calibration(Calibration& cal);
+
+void erase_calibration();
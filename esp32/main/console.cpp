@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <inttypes.h>
 #include <stdio.h>
@@ -6,13 +7,26 @@
 #include <string>
 #include <utility>
 
+#include "auto_lock.h"
+#include "calibration.h"
+#include "control_loop.h"
 #include "defines.h"
+#include "events.h"
+#include "job_queue.h"
+#include "microbench.h"
+#include "motion.h"
+#include "motion_stats.h"
+#include "motion_trace.h"
 #include "motor.h"
+#include "protocol.h"
+#include "stall.h"
+#include "status.h"
 #include "switches.h"
 
 #include <esp_system.h>
 #include <esp_log.h>
 #include <esp_console.h>
+#include <esp_timer.h>
 #include <esp_vfs_dev.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -21,20 +35,10 @@
 #include <argtable3/argtable3.h>
 #include <nvs.h>
 #include <nvs_flash.h>
+#include <soc/cpu.h>
 
 int verbosity = 0;
 
-void verbose_printf(const char* format, ...)
-{
-    if (verbosity == 0)
-        return;
-    printf("DEBUG: %ld ", (long) (xTaskGetTickCount()*portTICK_PERIOD_MS));
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
-}
-
 void verbose_wait()
 {
     if (verbosity < 2)
@@ -46,23 +50,25 @@ int locked_position = 0;
 int unlocked_position = 0;
 int maximum_position = 0;
 bool is_calibrated = false;
-enum State {
-    // Initial state until calibration
-    Unknown,
-    // The 'lock' command was successful
-    Locked,
-    // The 'unlock' command was successful
-    Unlocked,
-    // The position was changed manually to be neither 'locked' nor 'unlocked'
-    ChangedManually,
-    // The position was changed manually to be 'locked'
-    LockedManually,
-    // The position was changed manually to be 'unlocked'
-    UnlockedManually
-};
+// The travel between the end stops is known, even if the position is not
+bool is_span_known = false;
 State state = Unknown;
+// The calibration restored at boot could not be checked, as the handle was
+// lowered. refresh_status() has it checked once the handle is raised.
+static bool is_validation_pending = false;
+
+// Forget the position, also across resets. The travel between the end stops
+// is kept, so that calibrate only needs to find one of them.
+static void invalidate_calibration()
+{
+    if (is_calibrated)
+        erase_calibration();
+    is_calibrated = false;
+    state = Unknown;
+}
 
-static void update_state()
+// Only called by the motion task, also from microbench.cpp
+void update_state()
 {
     // Check if anybody has tinkered with the knob
     const auto pos = encoder.poll();
@@ -70,8 +76,7 @@ static void update_state()
     if (pos < 0 || pos > maximum_position + 2)
     {
         // We are out of synch.
-        is_calibrated = false;
-        state = Unknown;
+        invalidate_calibration();
         verbose_printf("update_state: impossible position, calibration needed\n");
     }
     
@@ -89,14 +94,12 @@ static void update_state()
         {
             // Door has been opened since we locked. Recalibration is needed.
             verbose_printf("update_state: door was open\n");
-            state = Unknown;
-            is_calibrated = false;
+            invalidate_calibration();
         }
         if (!switches.is_door_closed())
         {
             verbose_printf("update_state: door is open\n");
-            state = Unknown;
-            is_calibrated = false;
+            invalidate_calibration();
         }
         break;
 
@@ -128,6 +131,89 @@ static void update_state()
             state = UnlockedManually;
         }
     }
+
+    // Keep track of manual changes, in case of a reset
+    if (is_calibrated)
+        save_position(pos, false);
+}
+
+static void publish_status()
+{
+    StatusSnapshot s;
+    s.state = state;
+    s.is_calibrated = is_calibrated;
+    s.door_closed = switches.is_door_closed();
+    s.handle_raised = switches.is_handle_raised();
+    s.warning = auto_lock.is_warning();
+    s.position = encoder.poll();
+    s.time_us = esp_timer_get_time();
+    status_publisher.publish(s);
+    event_notifier.update(s, switches.get_door_change_time_us(),
+                          switches.get_handle_change_time_us());
+}
+
+static void IRAM_ATTR on_knob_moved(void*)
+{
+    jobs.wake_from_isr();
+}
+
+// Have the encoder wake the motion task as soon as the bolt leaves the
+// window of the current state, so that turning the knob is noticed at once
+static void watch_knob()
+{
+    static int watch_low = 0;
+    static int watch_high = 0;
+    int low, high;
+    switch (is_calibrated ? state : Unknown)
+    {
+    case Locked:
+    case LockedManually:
+        low = locked_position;
+        high = locked_position + 2*backoff_pulses;
+        break;
+    case Unlocked:
+    case UnlockedManually:
+        low = unlocked_position - 2*backoff_pulses;
+        high = unlocked_position;
+        break;
+    default:
+        encoder.disarm_watch();
+        return;
+    }
+    if (encoder.is_watch_armed() && low == watch_low && high == watch_high)
+        return;
+    watch_low = low;
+    watch_high = high;
+    // If the bolt is already outside, the next refresh will see it
+    encoder.arm_watch(low, high, &on_knob_moved);
+}
+
+static void lock_job(const JobQueue::Job& job);
+static void validate_calibration_job(const JobQueue::Job& job);
+
+// Called by the motion task between jobs, and when the knob is turned
+void refresh_status()
+{
+    switches.update();
+    update_state();
+    publish_status();
+    motion_stats.check_stop(encoder.poll());
+    watch_knob();
+    // Not while jobs are queued, as they were asked for after this status.
+    // A change of warning is published at the next refresh.
+    if (!jobs.is_busy() &&
+        auto_lock.update(status_publisher.read(), switches.get_door_change_time_us(),
+                         switches.get_handle_change_time_us()))
+    {
+        verbose_printf("auto_lock: locking\n");
+        jobs.submit(&lock_job);
+    }
+    if (is_validation_pending && !jobs.is_busy() && switches.is_handle_raised())
+    {
+        // Cleared by the job, so that it is only submitted once
+        verbose_printf("refresh_status: checking the saved calibration\n");
+        jobs.submit(&validate_calibration_job);
+    }
 }
 
 struct
@@ -214,35 +300,91 @@ static int set_backoff(int argc, char** argv)
     return 0;
 }
 
+static void IRAM_ATTR brake_on_target(void*)
+{
+    motor->brake_from_isr();
+}
+
+// Reverse until backoff_pulses have been counted, then brake
 static void backoff(int pwr)
 {
-    int delay = Motor::get_backoff_time_ms(pwr);
-    verbose_printf("backoff(): delay %d\n", delay);
-    delay /= portTICK_PERIOD_MS;
-    vTaskDelay(delay/2);
-    verbose_printf("backoff(): drive\n");
+    motor->brake();
+    // No end stop is expected here, so there is no need to go slower than usual
+    if (abs(pwr) < default_motor_power)
+        pwr = pwr > 0 ? default_motor_power : -default_motor_power;
+    const int start_pos = encoder.poll();
+    // Positive power makes the encoder count down, so reversing counts up
+    const int target = pwr > 0 ? start_pos + backoff_pulses : start_pos - backoff_pulses;
+    verbose_printf("backoff(): %d -> %d\n", start_pos, target);
+    const bool armed = encoder.arm_target(target, &brake_on_target, nullptr);
+    const auto start_us = esp_timer_get_time();
+    const auto start_ms = xTaskGetTickCount()*portTICK_PERIOD_MS;
+    const uint32_t max_engage_ms = motor->get_max_engage_time_ms(pwr);
+    const uint32_t max_backoff_ms =
+        max_engage_ms + backoff_pulses*motor->get_rotation_timeout_ms(pwr);
+    StallDetector stall(encoder, motor->get_rotation_timeout_ms(pwr));
+    bool engaged = false;
     motor->drive(-pwr);
-    vTaskDelay(delay);
-    verbose_printf("backoff(): brake\n");
+    while (1)
+    {
+        const auto now = xTaskGetTickCount()*portTICK_PERIOD_MS;
+        const int pos = encoder.poll();
+        if (abs(pos - start_pos) >= backoff_pulses)
+            break;
+        if (!engaged)
+        {
+            if (pos != start_pos)
+            {
+                engaged = true;
+                stall.start(pos, esp_timer_get_time());
+            }
+            else if (now - start_ms > max_engage_ms)
+            {
+                verbose_printf("backoff(): engage timeout\n");
+                break;
+            }
+        }
+        else if (stall.update(pos, esp_timer_get_time()))
+        {
+            verbose_printf("backoff(): stalled\n");
+            break;
+        }
+        if (now - start_ms > max_backoff_ms)
+        {
+            verbose_printf("backoff(): timeout\n");
+            break;
+        }
+        if (jobs.is_abort_requested())
+            break;
+        publish_status();
+        encoder.wait_for_target(10 / portTICK_PERIOD_MS);
+    }
     motor->brake();
-    vTaskDelay(delay/2);
+    if (armed)
+        encoder.disarm_target();
+    vTaskDelay(BACKOFF_SETTLE_MS/portTICK_PERIOD_MS);
+    last_backoff_pulses = abs(encoder.poll() - start_pos);
+    motion_stats.add(MotionStats::Backoff, esp_timer_get_time() - start_us);
+    verbose_printf("backoff(): moved %d in %ld ms\n", last_backoff_pulses,
+                   (long) (xTaskGetTickCount()*portTICK_PERIOD_MS - start_ms));
 }
 
 // true -> lock
-bool do_calibration(bool fwd)
+// If 'rehome' is set, the encoder is set to match the end stop found,
+// instead of measuring the travel.
+bool do_calibration(bool fwd, bool rehome = false)
 {
     const auto pwr = fwd ? MOTOR_CALIBRATE_POWER : -MOTOR_CALIBRATE_POWER;
     verbose_printf("- %s (%d)...\n", fwd ? "locking" : "unlocking", pwr);
     auto start_ms = xTaskGetTickCount()*portTICK_PERIOD_MS;
     const int start_pos = encoder.poll();
     verbose_printf("- start %ld pos %d\n", (long) start_ms, start_pos);
+    auto phase_start_us = esp_timer_get_time();
     bool engaged = false;
     motor->drive(pwr);
     const int MAX_TOTAL_PULSES = 2.5 * Encoder::STEPS_PER_REVOLUTION;
-    int last_encoder_pos = std::numeric_limits<int>::min();
-    int last_position_change = 0;
     const int max_engage_ms = motor->get_max_engage_time_ms(pwr);
-    const int no_rotation_timeout = motor->get_rotation_timeout_ms(pwr);
+    StallDetector stall(encoder, motor->get_rotation_timeout_ms(pwr));
     while (1)
     {
         const auto now = xTaskGetTickCount()*portTICK_PERIOD_MS;
@@ -261,36 +403,35 @@ bool do_calibration(bool fwd)
             {
                 engaged = true;
                 verbose_printf("Engaged: %d\n", pos);
-                last_position_change = now;
+                const auto now_us = esp_timer_get_time();
+                motion_stats.add(MotionStats::Engage, now_us - phase_start_us);
+                phase_start_us = now_us;
+                stall.start(pos, now_us);
             }
         }
-        else
+        else if (stall.update(pos, esp_timer_get_time()))
         {
-            if (pos != last_encoder_pos)
+            motor->brake();
+            motion_stats.add(MotionStats::Travel, esp_timer_get_time() - phase_start_us);
+            verbose_printf("Hit limit: %d (cruise %d pulses/s)\n",
+                           (int) stall.get_stall_position(), (int) stall.get_cruise_speed());
+            if (fwd)
             {
-                last_position_change = now;
-            }
-            else if (now - last_position_change > no_rotation_timeout)
-            {
-                motor->brake();
-                verbose_printf("Hit limit: %d\n", pos);
-                if (fwd)
-                {
-                    // Use this position (fully locked) as zero
-                    encoder.set_zero();
-                }
-                else
-                    // This is the maximum position
-                    maximum_position = pos;
-
-                verbose_wait();
-                backoff(pwr);
-                verbose_printf("After backoff: %d\n", encoder.poll());
-                verbose_printf("last change %ld\n", (long) last_position_change);
-                return true;
+                // Use this position (fully locked) as zero
+                encoder.set_zero();
             }
+            else if (rehome)
+                // The travel is already known
+                encoder.set_position(maximum_position);
+            else
+                // This is the maximum position
+                maximum_position = stall.get_stall_position();
+
+            verbose_wait();
+            backoff(pwr);
+            verbose_printf("After backoff: %d\n", encoder.poll());
+            return true;
         }
-        last_encoder_pos = pos;
         if (fabs(pos - start_pos) > MAX_TOTAL_PULSES)
         {
             backoff(pwr);
@@ -298,87 +439,121 @@ bool do_calibration(bool fwd)
             led.set_params(10, 100, 10);
             return false;
         }
+        if (jobs.is_abort_requested())
+        {
+            motor->brake();
+            printf("ERROR: Aborted\n");
+            return false;
+        }
+        publish_status();
         vTaskDelay(10 / portTICK_PERIOD_MS);
     }
 }
 
-static int calibrate(int argc, char** argv)
+static bool rehome();
+
+static void calibrate_job(const JobQueue::Job& job)
 {
+    MotionTrace::Scope trace(motion_trace, 'C', job.id);
+    MotionStats::Scope timing(motion_stats, MotionStats::Calibrate);
     state = Unknown;
 
-#ifdef SIMULATE
-    locked_position = 0;
-    unlocked_position = 50;
-    maximum_position = 60;
-    encoder_position = 45;
-    is_calibrated = true;
-    vTaskDelay(10000 / portTICK_PERIOD_MS);
-#else
-    verbose_printf("Calibrating...\n");
-
-    // We assume that current state is unlocked, so first step is to lock
     led.set_params(50, 100, 1);
-    bool ok = do_calibration(true);
-    motor->brake();
-    if (!ok)
-        return 0;
+    // If only the position has been lost, finding one end stop is enough
+    if (is_span_known)
+    {
+        const bool ok = rehome();
+        // Give up on the travel too, unless we were interrupted
+        is_span_known = ok || jobs.is_abort_requested();
+        if (!ok)
+            return;
+    }
+    else
+    {
+        verbose_printf("Calibrating...\n");
+
+        // We assume that current state is unlocked, so first step is to lock
+        bool ok = do_calibration(true);
+        motor->brake();
+        if (!ok)
+            return;
+
+        locked_position = 0;
+
+        // Now unlock
+        ok = do_calibration(false);
+        motor->brake();
+        if (!ok)
+            return;
+        // The end stop, like locked_position, and not where backoff() left it
+        unlocked_position = maximum_position;
+        is_span_known = true;
+    }
 
-    locked_position = 0;
-    
-    // Now unlock
-    ok = do_calibration(false);
-    motor->brake();
-    if (!ok)
-        return 0;
-    unlocked_position = encoder.poll();
-    
     led.set_params(LED_DEFAULT_DUTY_CYCLE_NUM,
                    LED_DEFAULT_DUTY_CYCLE_DEN,
                    LED_DEFAULT_PERIOD);
-#endif
+
     printf("OK: locked %d-%d Unlocked %d-%d\n",
            locked_position, locked_position + backoff_pulses,
            unlocked_position - backoff_pulses, unlocked_position);
 
     is_calibrated = true;
     state = Unlocked;
+
+    Calibration cal;
+    cal.locked_position = locked_position;
+    cal.unlocked_position = unlocked_position;
+    cal.maximum_position = maximum_position;
+    cal.position = encoder.poll();
+    save_calibration(cal);
     
     led.set_params(LED_DEFAULT_DUTY_CYCLE_NUM,
                    LED_DEFAULT_DUTY_CYCLE_DEN,
                    LED_DEFAULT_PERIOD);
-
-    return 0;
 }
 
-static int uncalibrate(int argc, char** argv)
+static void uncalibrate_job(const JobQueue::Job&)
 {
+    erase_calibration();
     is_calibrated = false;
+    is_span_known = false;
     state = Unknown;
 
     printf("OK\n");
-    
+}
+
+// Queue a job for the motion task and report its id
+static int submit(void (*run)(const JobQueue::Job&), int arg0 = 0, int arg1 = 0)
+{
+    const auto id = jobs.submit(run, arg0, arg1);
+    if (!id)
+    {
+        printf("ERROR: Too many jobs queued\n");
+        return 0;
+    }
+    printf("OK: job %u\n", (unsigned) id);
     return 0;
 }
 
+static int calibrate(int, char**)
+{
+    return submit(&calibrate_job);
+}
+
+static int uncalibrate(int, char**)
+{
+    return submit(&uncalibrate_job);
+}
+
 // Power  Pulses in 5s
 //  400    50
 //  500    65
 //  800   120
-int rotate(int argc, char** argv)
+static void rotate_job(const JobQueue::Job& job)
 {
-    if (argc < 1)
-    {
-        printf("ERROR: Missing argument\n");
-        return 1;
-    }
-    // arg_parser believes everything starting with - must be an option
-    const auto degrees = atoi(argv[1]);
-    if (degrees < -1000 || degrees > 1000)
-    {
-        printf("ERROR: Invalid degrees value\n");
-        return 1;
-    }
-
+    MotionTrace::Scope trace(motion_trace, 'R', job.id);
+    const int degrees = job.args[0];
     state = Unknown;
 
     const int sign = degrees < 0 ? -1 : 1;
@@ -407,21 +582,55 @@ int rotate(int argc, char** argv)
         const auto ticks = xTaskGetTickCount() - start_tick;
         if (ticks > MAX_TIME/portTICK_PERIOD_MS)
         {
+            motor->brake();
             printf("ERROR: Timeout (%lu ticks)!\n", ticks);
-            return 0;
+            return;
+        }
+        if (jobs.is_abort_requested())
+        {
+            motor->brake();
+            printf("ERROR: Aborted\n");
+            return;
         }
         vTaskDelay(10 / portTICK_PERIOD_MS);
     }
     motor->brake();
-    return 0;
 }
 
-int do_drive(int sign, int pwr, int ms)
+int rotate(int argc, char** argv)
 {
-    motor->drive(sign * pwr);
-    vTaskDelay(ms/portTICK_PERIOD_MS);
+    if (argc < 1)
+    {
+        printf("ERROR: Missing argument\n");
+        return 1;
+    }
+    // arg_parser believes everything starting with - must be an option
+    const auto degrees = atoi(argv[1]);
+    if (degrees < -1000 || degrees > 1000)
+    {
+        printf("ERROR: Invalid degrees value\n");
+        return 1;
+    }
+    return submit(&rotate_job, degrees);
+}
+
+// args: signed power, milliseconds
+static void drive_job(const JobQueue::Job& job)
+{
+    MotionTrace::Scope trace(motion_trace, 'D', job.id);
+    state = Unknown;
+    motor->drive(job.args[0]);
+    const auto start_tick = xTaskGetTickCount();
+    while (xTaskGetTickCount() - start_tick < job.args[1]/portTICK_PERIOD_MS)
+    {
+        if (jobs.is_abort_requested())
+        {
+            printf("ERROR: Aborted\n");
+            break;
+        }
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
     motor->brake();
-    return 0;
 }
 
 int forward(int argc, char** argv)
@@ -444,8 +653,7 @@ int forward(int argc, char** argv)
         printf("ERROR: Invalid milliseconds value\n");
         return 1;
     }
-    state = Unknown;
-    return do_drive(1, pwr, ms);
+    return submit(&drive_job, pwr, ms);
 }
 
 int reverse(int argc, char** argv)
@@ -468,18 +676,19 @@ int reverse(int argc, char** argv)
         printf("ERROR: Invalid milliseconds value\n");
         return 1;
     }
-    state = Unknown;
-    return do_drive(-1, pwr, ms);
+    return submit(&drive_job, -pwr, ms);
 }
 
 struct rotate_result
 {
     bool ok = false;
     bool reversed = false;
+    // Stopped by the handle or an abort, rather than by the mechanism
+    bool interrupted = false;
     std::string error_message;
 };
 
-rotate_result rotate_to(bool fwd, int position)
+static rotate_result do_rotate_to(bool fwd, int position)
 {
     rotate_result res;
     
@@ -503,19 +712,30 @@ rotate_result rotate_to(bool fwd, int position)
     verbose_printf("rotate_to: steps_needed %d\n", steps_needed);
 
     const auto start_ms = xTaskGetTickCount()*portTICK_PERIOD_MS;
+    auto phase_start_us = esp_timer_get_time();
     bool engaged = false;
     const int pwr = fwd ? default_motor_power : -default_motor_power;
     motor->drive(pwr);
     const int max_engage_ms = motor->get_max_engage_time_ms(pwr);
-    const int no_rotation_timeout = motor->get_rotation_timeout_ms(pwr);
-    int last_encoder_pos = std::numeric_limits<int>::min();
-    int last_position_change = 0;
+    StallDetector stall(encoder, motor->get_rotation_timeout_ms(pwr));
+    MotionController controller(*motor, encoder);
     while (1)
     {
         if (!switches.is_handle_raised())
         {
+            control_loop.set_controller(nullptr);
+            motor->brake();
             printf("ERROR: Handle raised during rotate\n");
             res.error_message = "handle raised during rotate";
+            res.interrupted = true;
+            return res;
+        }
+        if (jobs.is_abort_requested())
+        {
+            control_loop.set_controller(nullptr);
+            motor->brake();
+            res.error_message = "aborted";
+            res.interrupted = true;
             return res;
         }
         const auto now = xTaskGetTickCount()*portTICK_PERIOD_MS;
@@ -535,30 +755,29 @@ rotate_result rotate_to(bool fwd, int position)
             {
                 engaged = true;
                 verbose_printf("Engaged\n");
-                last_position_change = now;
+                const auto now_us = esp_timer_get_time();
+                motion_stats.add(MotionStats::Engage, now_us - phase_start_us);
+                phase_start_us = now_us;
+                // From here on, power is set by the speed profile in the control loop
+                controller.start(fwd, start_pos, steps_needed, MOTOR_MAX_POWER, now_us);
+                control_loop.set_controller(&controller);
+                stall.start(pos, now_us);
             }
         }
-        else
+        else if (stall.update(pos, esp_timer_get_time(), controller.get_reference_speed()))
         {
-            if (pos != last_encoder_pos)
-            {
-                last_position_change = now;
-            }
-            else if (now - last_position_change > no_rotation_timeout)
-            {
-                motor->brake();
-                verbose_printf("Hit limit\n");
-                verbose_wait();
-                backoff(pwr);
-                verbose_printf("last change %ld\n", (long) last_position_change);
-                res.error_message = "hit limit";
-                return res;
-            }
+            control_loop.set_controller(nullptr);
+            motor->brake();
+            verbose_printf("Hit limit: %d\n", (int) stall.get_stall_position());
+            verbose_wait();
+            backoff(pwr);
+            res.error_message = "hit limit";
+            return res;
         }
-        last_encoder_pos = pos;
         const int steps_total = fabs(pos - start_pos);
         if (steps_total > MAX_TOTAL_PULSES)
         {
+            control_loop.set_controller(nullptr);
             backoff(pwr);
             printf("ERROR: Timeout (%d pulses)!\n", steps_total);
             res.error_message = "limit timeout";
@@ -566,36 +785,69 @@ rotate_result rotate_to(bool fwd, int position)
         }
         if (steps_total >= steps_needed)
         {
+            motion_stats.add(MotionStats::Travel, esp_timer_get_time() - phase_start_us);
             verbose_printf("rotate_to: steps_total %d\n", steps_needed);
             break;
         }
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+        publish_status();
+        // Returns early if the target is reached
+        encoder.wait_for_target(10 / portTICK_PERIOD_MS);
     }
 
+    control_loop.set_controller(nullptr);
     motor->brake();
+    motion_stats.set_stop(position, fwd);
     res.ok = true;
     return res;
 }
 
-static int lock(int, char**)
+rotate_result rotate_to(bool fwd, int position)
 {
+    // Let the PCNT interrupt brake the motor the moment the target is reached,
+    // rather than up to a polling interval later
+    encoder.arm_target(position, &brake_on_target, nullptr);
+    const auto res = do_rotate_to(fwd, position);
+    encoder.disarm_target();
+    return res;
+}
+
+// Find the nearest end stop and set the encoder from it, using the travel
+// found by the last full calibration. Leaves the lock unlocked, as a full
+// calibration does.
+static bool rehome()
+{
+    const int pos = encoder.poll();
+    const bool fwd = pos - locked_position < maximum_position - pos;
+    verbose_printf("Re-homing from %d...\n", pos);
+    const bool ok = do_calibration(fwd, true);
+    motor->brake();
+    if (!ok)
+        return false;
+    if (fwd)
+        return rotate_to(false, unlocked_position - backoff_pulses + 1).ok;
+    return true;
+}
+
+static void lock_job(const JobQueue::Job& job)
+{
+    MotionTrace::Scope trace(motion_trace, 'L', job.id);
+    MotionStats::Scope timing(motion_stats, MotionStats::Lock);
     if (!is_calibrated)
     {
         printf("ERROR: not calibrated\n");
-        return 0;
+        return;
     }
-#ifdef SIMULATE
-    state = Locked;
-    encoder_position = 5;
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
-#else
     update_state();
-#endif
     if (state != Locked)
     {
         state = Unknown;
         led.set_params(50, 100, 1);
         const auto res = rotate_to(true, locked_position + backoff_pulses - 1);
+        if (!res.ok && jobs.is_abort_requested())
+        {
+            printf("ERROR: could not lock: %s\n", res.error_message.c_str());
+            return;
+        }
         if (!res.ok)
         {
             backoff(default_motor_power);
@@ -603,46 +855,42 @@ static int lock(int, char**)
             {
                 printf("ERROR: could not lock (still unlocked): %s\n", res.error_message.c_str());
                 state = Unlocked;
+                save_position(encoder.poll(), true);
             }
             else
                 printf("ERROR: could not lock (or unlock): %s\n", res.error_message.c_str());
-            return 0;
-        }
-        if (!res.reversed)
-        {
-            // Back off
-            backoff(default_motor_power);
-            verbose_printf("Backed off to %d\n", encoder.poll());
+            return;
         }
         led.set_params(LED_DEFAULT_DUTY_CYCLE_NUM,
                        LED_DEFAULT_DUTY_CYCLE_DEN,
                        LED_DEFAULT_PERIOD);
         state = Locked;
+        save_position(encoder.poll(), true);
     }
     switches.set_door_locked();
     printf("OK: locked\n");
-    return 0;
 }
 
-static int unlock(int, char**)
+static void unlock_job(const JobQueue::Job& job)
 {
+    MotionTrace::Scope trace(motion_trace, 'U', job.id);
+    MotionStats::Scope timing(motion_stats, MotionStats::Unlock);
     if (!is_calibrated)
     {
         printf("ERROR: not calibrated\n");
-        return 0;
+        return;
     }
-#ifdef SIMULATE
-    state = Unlocked;
-    encoder_position = 45;
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
-#else
     update_state();
-#endif
     if (state != Unlocked)
     {
         state = Unknown;
         led.set_params(10, 100, 1);
         const auto res = rotate_to(false, unlocked_position - backoff_pulses + 1);
+        if (!res.ok && jobs.is_abort_requested())
+        {
+            printf("ERROR: could not unlock: %s\n", res.error_message.c_str());
+            return;
+        }
         if (!res.ok)
         {
             backoff(-default_motor_power);
@@ -650,23 +898,290 @@ static int unlock(int, char**)
             {
                 printf("ERROR: could not unlock (still locked): %s\n", res.error_message.c_str());
                 state = Locked;
+                save_position(encoder.poll(), true);
             }
             else
                 printf("ERROR: could not unlock (or lock): %s\n", res.error_message.c_str());
-            return 0;
-        }
-        if (!res.reversed)
-        {
-            // Back off
-            backoff(-default_motor_power);
-            verbose_printf("Backed off\n");
+            return;
         }
         led.set_params(LED_DEFAULT_DUTY_CYCLE_NUM,
                        LED_DEFAULT_DUTY_CYCLE_DEN,
                        LED_DEFAULT_PERIOD);
         state = Unlocked;
+        save_position(encoder.poll(), true);
     }
     printf("OK: unlocked\n");
+}
+
+enum ValidationResult
+{
+    ValidationPassed,
+    ValidationFailed,
+    // Cut short by the handle or an abort, which proves nothing
+    ValidationInterrupted,
+};
+
+// Check a restored calibration by moving a few pulses towards the end stop
+// on the locked ('fwd') or unlocked side, and back again, so that the bolt
+// ends up where it was, inside its window. This fails if the mechanism
+// cannot move as far as it should be able to, e.g. if the bolt has been
+// turned while the power was off.
+static ValidationResult validate_calibration(bool fwd)
+{
+    const int pos = encoder.poll();
+    const int room = fwd ? pos - locked_position : maximum_position - pos;
+    const int pulses = std::min(VALIDATION_PULSES, room - 1);
+    if (pulses <= 0)
+        return ValidationFailed;
+    verbose_printf("validate_calibration: %d, %d pulses towards %s and back\n",
+                   pos, pulses, fwd ? "locked" : "unlocked");
+    auto res = rotate_to(fwd, fwd ? pos - pulses : pos + pulses);
+    if (res.ok)
+        res = rotate_to(!fwd, pos);
+    if (res.ok)
+        return ValidationPassed;
+    return res.interrupted ? ValidationInterrupted : ValidationFailed;
+}
+
+// Check the calibration loaded by restore_calibration_job() against the
+// mechanism. It is only erased if the encoder shows it to be wrong.
+static void check_restored_calibration()
+{
+    const int pos = encoder.poll();
+    if (pos < locked_position || pos > maximum_position)
+    {
+        erase_calibration();
+        printf("ERROR: saved calibration is not valid\n");
+        return;
+    }
+    if (!switches.is_handle_raised())
+    {
+        is_validation_pending = true;
+        printf("OK: saved calibration is checked when the handle is raised\n");
+        return;
+    }
+
+    // The windows may overlap, so go by the nearest of the positions that
+    // lock() and unlock() move to
+    const int lock_target = locked_position + backoff_pulses - 1;
+    const int unlock_target = unlocked_position - backoff_pulses + 1;
+    const bool locked = abs(pos - lock_target) <= abs(pos - unlock_target);
+    switch (validate_calibration(locked))
+    {
+    case ValidationPassed:
+        break;
+    case ValidationFailed:
+        erase_calibration();
+        printf("ERROR: saved calibration is not valid\n");
+        return;
+    case ValidationInterrupted:
+        // An abort leaves the calibration for the next boot
+        is_validation_pending = !switches.is_handle_raised();
+        printf(is_validation_pending ?
+               "OK: saved calibration is checked when the handle is raised\n" :
+               "ERROR: saved calibration not checked\n");
+        return;
+    }
+    is_calibrated = true;
+    const int new_pos = encoder.poll();
+    if (locked)
+        state = new_pos <= locked_position + 2*backoff_pulses ? LockedManually : ChangedManually;
+    else
+        state = new_pos >= unlocked_position - 2*backoff_pulses ? UnlockedManually : ChangedManually;
+    save_position(new_pos, true);
+    // Nothing is known about the door before the reset, only that it is closed now
+    if (state == LockedManually && switches.is_door_closed())
+        switches.set_door_locked();
+    led.set_params(LED_DEFAULT_DUTY_CYCLE_NUM,
+                   LED_DEFAULT_DUTY_CYCLE_DEN,
+                   LED_DEFAULT_PERIOD);
+    printf("OK: calibration restored, locked %d-%d Unlocked %d-%d\n",
+           locked_position, locked_position + backoff_pulses,
+           unlocked_position - backoff_pulses, unlocked_position);
+}
+
+// Restore the calibration saved before the last reset, if it is still valid
+static void restore_calibration_job(const JobQueue::Job&)
+{
+    Calibration cal;
+    if (!load_calibration(cal))
+        return;
+    locked_position = cal.locked_position;
+    unlocked_position = cal.unlocked_position;
+    maximum_position = cal.maximum_position;
+    encoder.set_position(cal.position);
+    // Even if the position turns out to be wrong, the travel is not
+    is_span_known = true;
+    check_restored_calibration();
+}
+
+static void validate_calibration_job(const JobQueue::Job&)
+{
+    is_validation_pending = false;
+    // Unless calibrated afresh in the meantime
+    if (!is_calibrated)
+        check_restored_calibration();
+}
+
+static int lock(int, char**)
+{
+    return submit(&lock_job);
+}
+
+static int unlock(int, char**)
+{
+    return submit(&unlock_job);
+}
+
+static int abort_jobs(int, char**)
+{
+    const bool busy = jobs.is_busy();
+    jobs.abort();
+    printf(busy ? "OK: aborted\n" : "OK: idle\n");
+    return 0;
+}
+
+static const char* job_status_name(JobQueue::Status status)
+{
+    switch (status)
+    {
+    case JobQueue::Queued:
+        return "queued";
+    case JobQueue::Running:
+        return "running";
+    case JobQueue::Done:
+        return "done";
+    case JobQueue::Aborted:
+        return "aborted";
+    default:
+        return "unknown";
+    }
+}
+
+// wait [<id> [<timeout ms>]]: wait for a job, by default the last one
+static int wait(int argc, char** argv)
+{
+    // arg_parser does not do optional positional arguments
+    const uint32_t id = argc > 1 ? atoi(argv[1]) : jobs.get_last_id();
+    const int timeout_ms = argc > 2 ? atoi(argv[2]) : MAX_JOB_WAIT_MS;
+    if (id == 0 || id > jobs.get_last_id() || timeout_ms < 0)
+    {
+        printf("ERROR: Invalid job\n");
+        return 1;
+    }
+    if (!jobs.wait(id, timeout_ms/portTICK_PERIOD_MS))
+    {
+        printf("ERROR: job %u %s\n", (unsigned) id, job_status_name(jobs.get_status(id)));
+        return 0;
+    }
+    printf("OK: job %u %s\n", (unsigned) id, job_status_name(jobs.get_status(id)));
+    return 0;
+}
+
+// loop_stats [reset]
+static int loop_stats(int argc, char** argv)
+{
+    control_loop.print_stats();
+    if (argc > 1 && !strcmp(argv[1], "reset"))
+        control_loop.reset_stats();
+    return 0;
+}
+
+// trace [index]
+static int trace(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        motion_trace.list();
+        return 0;
+    }
+    if (!motion_trace.dump(atoi(argv[1])))
+    {
+        printf("ERROR: No such trace\n");
+        return 1;
+    }
+    printf("OK: trace dumped\n");
+    return 0;
+}
+
+// stats [reset]
+static int stats(int argc, char** argv)
+{
+    motion_stats.print();
+    if (argc > 1 && !strcmp(argv[1], "reset"))
+        motion_stats.reset();
+    return 0;
+}
+
+static uint32_t cycle_count()
+{
+    return esp_cpu_get_ccount();
+}
+
+// Run in the motion task, so that update_state() is called where it always is
+static void bench_job(const JobQueue::Job&)
+{
+    microbench_run(MICROBENCH_MOTION, stdout, &cycle_count, "cycles",
+                   MICROBENCH_MIN_MS*1000*CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+}
+
+// The console task cases run here rather than in the job, as
+// esp_console_run() is not reentrant. The console is blocked until the job
+// is done, so the two never run at once. Calling esp_console_run() from
+// within a command only reuses its line buffer, and argv is not used after.
+static int bench(int, char**)
+{
+    const auto id = jobs.submit(&bench_job, 0, 0);
+    if (!id)
+    {
+        printf("ERROR: Too many jobs queued\n");
+        return 0;
+    }
+    printf("OK: job %u\n", (unsigned) id);
+    if (!jobs.wait(id, MAX_JOB_WAIT_MS/portTICK_PERIOD_MS) ||
+        jobs.get_status(id) != JobQueue::Done)
+    {
+        printf("ERROR: job %u %s\n", (unsigned) id, job_status_name(jobs.get_status(id)));
+        return 0;
+    }
+    microbench_run(MICROBENCH_CONSOLE, stdout, &cycle_count, "cycles",
+                   MICROBENCH_MIN_MS*1000*CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+    return 0;
+}
+
+// autolock [<lock delay s> <warning delay s> <postpone s>], -1 for never
+static int autolock(int argc, char** argv)
+{
+    // arg_parser does not do optional positional arguments
+    if (argc > 1)
+    {
+        if (argc != 4)
+        {
+            printf("ERROR: Give all of <lock delay> <warning delay> <postpone>\n");
+            return 1;
+        }
+        AutoLock::Params params;
+        params.lock_delay_s = atoi(argv[1]);
+        params.warn_delay_s = atoi(argv[2]);
+        params.postpone_s = atoi(argv[3]);
+        if (params.lock_delay_s < -1 || params.warn_delay_s < -1 || params.postpone_s < 0)
+        {
+            printf("ERROR: Invalid delay\n");
+            return 1;
+        }
+        auto_lock.set_params(params);
+    }
+    const auto params = auto_lock.get_params();
+    printf("OK: autolock lock %d warn %d postpone %d warning %d\n",
+           (int) params.lock_delay_s, (int) params.warn_delay_s, (int) params.postpone_s,
+           (int) auto_lock.is_warning());
+    return 0;
+}
+
+static int postpone(int, char**)
+{
+    auto_lock.postpone();
+    printf("OK: postponed\n");
     return 0;
 }
 
@@ -685,21 +1200,16 @@ static int set_verbosity(int argc, char** argv)
 
 static int version(int, char**)
 {
-#ifdef SIMULATE
-    printf("Danalock " VERSION " - SIMULATION MODE\n");
-#else
     printf("Danalock " VERSION "\n");
-#endif
     return 0;
 }
 
-static int status(int, char**)
+// Format the 'status' reply for 's'. Return false if the state is not known.
+bool format_status(const StatusSnapshot& s, char* buf, size_t size)
 {
-    switches.update();
-    verbose_printf("status: initial state %d\n", (int) state);
-    update_state();
     const char* status = "?";
-    switch (state)
+    bool ok = true;
+    switch (s.state)
     {
     case Unknown:
         status = "unknown";
@@ -720,23 +1230,36 @@ static int status(int, char**)
         status = "changedmanually";
         break;
     default:
-        printf("ERROR: Unhandled state: %d\n", (int) state);
-        assert(false);
+        ok = false;
         break;
     }
-    const auto pos = encoder.poll();
-    const auto raised = switches.is_handle_raised();
-    printf("OK: status %s %s %s %d\n",
-           status,
-           switches.is_door_closed() ? "closed" : "open",
-           raised ? "raised" : "lowered",
-           (int) pos);
+    snprintf(buf, size, "OK: status %s %s %s %d",
+             status,
+             s.door_closed ? "closed" : "open",
+             s.handle_raised ? "raised" : "lowered",
+             (int) s.position);
+    return ok;
+}
+
+static int status(int, char**)
+{
+    // Only reads what the motion task has published
+    const auto s = status_publisher.read();
+    verbose_printf("status: state %d, %d us old\n", (int) s.state,
+                   (int) (esp_timer_get_time() - s.time_us));
+    char buf[64];
+    if (!format_status(s, buf, sizeof(buf)))
+    {
+        printf("ERROR: Unhandled state: %d\n", (int) s.state);
+        assert(false);
+    }
+    printf("%s\n", buf);
     return 0;
 }
 
-static int read_switches(int, char**)
+static void read_switches_job(const JobQueue::Job&)
 {
-    for (int n = 0; n < 100; ++n)
+    for (int n = 0; n < 100 && !jobs.is_abort_requested(); ++n)
     {
         vTaskDelay(500/portTICK_PERIOD_MS);
         printf("Door %d handle %d - %d %d\n",
@@ -748,27 +1271,134 @@ static int read_switches(int, char**)
     }
     update_state();
     printf("done\n");
-    return 0;
 }
 
-static int read_encoder(int, char**)
+static void read_encoder_job(const JobQueue::Job&)
 {
-    for (int n = 0; n < 100; ++n)
+    for (int n = 0; n < 100 && !jobs.is_abort_requested(); ++n)
     {
         vTaskDelay(500/portTICK_PERIOD_MS);
         printf("Encoder %" PRId64 "\n", encoder.poll());
-        led.update();
     }
     update_state();
     printf("done\n");
-    return 0;
 }
 
-static int zero_encoder(int, char**)
+static void zero_encoder_job(const JobQueue::Job&)
 {
     encoder.set_zero();
     printf("Zeroed\n");
-    return 0;
+}
+
+static int read_switches(int, char**)
+{
+    return submit(&read_switches_job);
+}
+
+static int read_encoder(int, char**)
+{
+    return submit(&read_encoder_job);
+}
+
+static int zero_encoder(int, char**)
+{
+    return submit(&zero_encoder_job);
+}
+
+static void frame_status(const Frame&, Frame& reply)
+{
+    const auto s = status_publisher.read();
+    uint8_t flags = 0;
+    if (s.is_calibrated)
+        flags |= FRAME_STATUS_CALIBRATED;
+    if (s.door_closed)
+        flags |= FRAME_STATUS_DOOR_CLOSED;
+    if (s.handle_raised)
+        flags |= FRAME_STATUS_HANDLE_RAISED;
+    if (jobs.is_busy())
+        flags |= FRAME_STATUS_BUSY;
+    if (s.warning)
+        flags |= FRAME_STATUS_WARNING;
+    reply.put_u8(s.state);
+    reply.put_u8(flags);
+    reply.put_i32(s.position);
+    reply.put_u32(esp_timer_get_time() - s.time_us);
+}
+
+static void frame_telemetry(const Frame&, Frame& reply)
+{
+    reply.put_i32(encoder.poll());
+    reply.put_i32(encoder.get_velocity()*1000);
+    reply.put_i32(encoder.get_acceleration()*1000);
+    reply.put_u16(last_backoff_pulses);
+}
+
+static void frame_submit(Frame& reply, void (*run)(const JobQueue::Job&))
+{
+    const auto id = jobs.submit(run);
+    if (!id)
+        reply.payload[0] = FRAME_BUSY;
+    reply.put_u32(id);
+}
+
+static void frame_lock(const Frame&, Frame& reply)
+{
+    frame_submit(reply, &lock_job);
+}
+
+static void frame_unlock(const Frame&, Frame& reply)
+{
+    frame_submit(reply, &unlock_job);
+}
+
+static void frame_calibrate(const Frame&, Frame& reply)
+{
+    frame_submit(reply, &calibrate_job);
+}
+
+static void frame_abort(const Frame&, Frame&)
+{
+    jobs.abort();
+}
+
+static void frame_job_status(const Frame& request, Frame& reply)
+{
+    if (request.length < 4)
+    {
+        reply.payload[0] = FRAME_BAD_LENGTH;
+        return;
+    }
+    reply.put_u8(jobs.get_status(request.get_u32(0)));
+}
+
+static void frame_events(const Frame& request, Frame& reply)
+{
+    if (request.length < 1)
+    {
+        reply.payload[0] = FRAME_BAD_LENGTH;
+        return;
+    }
+    event_notifier.set_mask(request.payload[0]);
+    reply.put_u32(event_notifier.get_coalesced());
+}
+
+static void frame_postpone(const Frame&, Frame&)
+{
+    auto_lock.postpone();
+}
+
+static void register_frame_handlers()
+{
+    frame_register(FRAME_PING, [](const Frame&, Frame&) {});
+    frame_register(FRAME_STATUS, &frame_status);
+    frame_register(FRAME_TELEMETRY, &frame_telemetry);
+    frame_register(FRAME_LOCK, &frame_lock);
+    frame_register(FRAME_UNLOCK, &frame_unlock);
+    frame_register(FRAME_CALIBRATE, &frame_calibrate);
+    frame_register(FRAME_ABORT, &frame_abort);
+    frame_register(FRAME_JOB_STATUS, &frame_job_status);
+    frame_register(FRAME_EVENTS, &frame_events);
+    frame_register(FRAME_POSTPONE, &frame_postpone);
 }
 
 void initialize_console()
@@ -825,6 +1455,8 @@ extern "C" void console_task(void*)
 {
     initialize_console();
 
+    jobs.submit(&restore_calibration_job);
+
     // Register commands
     esp_console_register_help_command();
 
@@ -905,7 +1537,8 @@ extern "C" void console_task(void*)
 
     const esp_console_cmd_t calibrate_cmd = {
         .command = "calibrate",
-        .help = "Calibrate locked/unlocked positions",
+        .help = "Calibrate locked/unlocked positions. If the travel is already known, "
+                "only the nearest end stop is found; run uncalibrate first to measure it again",
         .hint = nullptr,
         .func = &calibrate,
         .argtable = nullptr
@@ -977,10 +1610,93 @@ extern "C" void console_task(void*)
     };
     ESP_ERROR_CHECK(esp_console_cmd_register(&read_switches_cmd));
 
+    const esp_console_cmd_t loop_stats_cmd = {
+        .command = "loop_stats",
+        .help = "Show control loop jitter and execution time. 'loop_stats reset' also clears them",
+        .hint = nullptr,
+        .func = &loop_stats,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&loop_stats_cmd));
+
+    const esp_console_cmd_t stats_cmd = {
+        .command = "stats",
+        .help = "Show timing of the phases of lock, unlock and calibrate. 'stats reset' also clears them",
+        .hint = nullptr,
+        .func = &stats,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&stats_cmd));
+
+    const esp_console_cmd_t autolock_cmd = {
+        .command = "autolock",
+        .help = "Show the auto-lock settings. 'autolock <lock s> <warn s> <postpone s>' sets them, -1 for never",
+        .hint = nullptr,
+        .func = &autolock,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&autolock_cmd));
+
+    const esp_console_cmd_t postpone_cmd = {
+        .command = "postpone",
+        .help = "End the auto-lock warning and put it off (the Open button)",
+        .hint = nullptr,
+        .func = &postpone,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&postpone_cmd));
+
+    const esp_console_cmd_t bench_cmd = {
+        .command = "bench",
+        .help = "Time the code run on every tick or command, in CPU cycles",
+        .hint = nullptr,
+        .func = &bench,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&bench_cmd));
+
+    const esp_console_cmd_t trace_cmd = {
+        .command = "trace",
+        .help = "List the recorded motion traces. 'trace <n>' dumps trace n (0 is the latest) as base64",
+        .hint = nullptr,
+        .func = &trace,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&trace_cmd));
+
+    const esp_console_cmd_t abort_cmd = {
+        .command = "abort",
+        .help = "Stop the running job and drop queued ones",
+        .hint = nullptr,
+        .func = &abort_jobs,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&abort_cmd));
+
+    const esp_console_cmd_t wait_cmd = {
+        .command = "wait",
+        .help = "Wait for job [<id>] (default: the last one) to finish, for at most [<timeout ms>]",
+        .hint = nullptr,
+        .func = &wait,
+        .argtable = nullptr
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&wait_cmd));
+
+    register_frame_handlers();
+
     const char* prompt = "";
 
     while (true)
     {
+        // Binary frames and text commands share the UART
+        const int c = fgetc(stdin);
+        if (c == FRAME_SYNC)
+        {
+            frame_handle();
+            continue;
+        }
+        ungetc(c, stdin);
+
         char* line = linenoise(prompt);
         if (!line)
             continue;
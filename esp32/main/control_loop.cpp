@@ -0,0 +1,109 @@
+#include "control_loop.h"
+#include "defines.h"
+#include "motion_trace.h"
+
+#include <stdio.h>
+#include <cstdlib>
+
+#include <freertos/task.h>
+
+void ControlLoop::start(int rate_hz, int core, int priority)
+{
+    period_us = 1000000/rate_hz;
+    wake_sem = xSemaphoreCreateBinary();
+    mutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(task, "control_loop", 4*1024, this, priority, NULL, core);
+
+    esp_timer_create_args_t args = {};
+    args.callback = &timer_callback;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "control_loop";
+    args.skip_unhandled_events = true;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+}
+
+int ControlLoop::get_rate_hz() const
+{
+    return period_us ? 1000000/period_us : 0;
+}
+
+void ControlLoop::set_controller(MotionController* new_controller)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    controller = new_controller;
+    update_timer();
+    xSemaphoreGive(mutex);
+}
+
+void ControlLoop::set_tracing(bool tracing)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    is_tracing = tracing;
+    update_timer();
+    xSemaphoreGive(mutex);
+}
+
+void ControlLoop::update_timer()
+{
+    const bool is_needed = controller || is_tracing;
+    if (is_needed == is_running)
+        return;
+    if (is_needed)
+    {
+        is_resumed.store(true);
+        ESP_ERROR_CHECK(esp_timer_start_periodic(timer, period_us));
+    }
+    else
+        ESP_ERROR_CHECK(esp_timer_stop(timer));
+    is_running = is_needed;
+}
+
+void ControlLoop::timer_callback(void* arg)
+{
+    auto self = static_cast<ControlLoop*>(arg);
+    // A binary semaphore that is already given means the last cycle is still running
+    if (xSemaphoreGive(self->wake_sem) != pdTRUE)
+        self->overruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ControlLoop::task(void* arg)
+{
+    auto self = static_cast<ControlLoop*>(arg);
+    while (true)
+    {
+        xSemaphoreTake(self->wake_sem, portMAX_DELAY);
+        self->run_cycle();
+    }
+}
+
+void ControlLoop::run_cycle()
+{
+    const auto wake_us = esp_timer_get_time();
+    if (!is_resumed.exchange(false) && last_wake_us)
+        jitter.add(std::llabs(wake_us - last_wake_us - period_us));
+    last_wake_us = wake_us;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    const bool is_controlled = controller != nullptr;
+    if (controller)
+        controller->update(encoder.poll(), wake_us);
+    xSemaphoreGive(mutex);
+    motion_trace.sample(wake_us, is_controlled);
+
+    exec_time.add(esp_timer_get_time() - wake_us);
+}
+
+void ControlLoop::print_stats() const
+{
+    printf("OK: control loop %d Hz, overruns %u\n", get_rate_hz(), (unsigned) overruns.load());
+    jitter.print("jitter");
+    exec_time.print("exec");
+}
+
+void ControlLoop::reset_stats()
+{
+    jitter.reset();
+    exec_time.reset();
+    overruns.store(0);
+}
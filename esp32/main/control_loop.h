@@ -0,0 +1,68 @@
+#pragma once
+
+#include "histogram.h"
+#include "motion.h"
+
+#include <atomic>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/// Runs the motion controller at a fixed rate. A periodic esp_timer wakes a
+/// high priority task pinned to a core of its own, so the control timing
+/// does not depend on the tick rate or on what the other tasks are doing.
+/// The timer only runs while there is a controller or an open motion trace.
+/// The period jitter and execution time of each cycle are recorded.
+class ControlLoop
+{
+public:
+    /// Create the timer and start the task.
+    void start(int rate_hz, int core, int priority);
+
+    int get_rate_hz() const;
+
+    /// Let 'controller' drive the motor from the loop, or stop (nullptr).
+    /// Once this returns, the previous controller is no longer being called.
+    void set_controller(MotionController* controller);
+
+    /// Keep the loop running while a motion trace is open, so it is sampled.
+    void set_tracing(bool tracing);
+
+    /// Print the jitter and execution time histograms.
+    void print_stats() const;
+
+    void reset_stats();
+
+private:
+    static void timer_callback(void* arg);
+
+    static void task(void* arg);
+
+    void run_cycle();
+
+    /// Start or stop the timer as needed. Called with 'mutex' held.
+    void update_timer();
+
+    int period_us = 0;
+    esp_timer_handle_t timer = nullptr;
+    /// Given by the timer, taken by the task
+    SemaphoreHandle_t wake_sem = nullptr;
+    /// Held while a cycle runs
+    SemaphoreHandle_t mutex = nullptr;
+    MotionController* controller = nullptr;
+    bool is_tracing = false;
+    bool is_running = false;
+    /// Set when the timer starts, so the idle time before the first cycle
+    /// is not counted as jitter
+    std::atomic<bool> is_resumed{false};
+    int64_t last_wake_us = 0;
+    /// Deviation of the time between cycles from the nominal period
+    Histogram jitter;
+    /// Time taken by a cycle
+    Histogram exec_time;
+    /// Number of times the timer fired before the previous cycle was done
+    std::atomic<uint32_t> overruns{0};
+};
+
+extern ControlLoop control_loop;
@@ -2,6 +2,7 @@
 
 #include "encoder.h"
 #include "led.h"
+#include "log_ring.h"
 #include "motor.h"
 
 #define VERSION "1.4"
@@ -26,10 +27,41 @@ constexpr const int MOTOR_CALIBRATE_POWER = 250;
 /// Motor power for normal operation
 constexpr const int MOTOR_DEFAULT_POWER = 500;
 
+/// Upper limit for closed-loop motor power
+constexpr const int MOTOR_MAX_POWER = 1000;
+
 constexpr const int DEFAULT_BACKOFF_PULSES = 20;
 
-/// Number of ms to back off after hitting limit
-constexpr const int BACKOFF_MS = 750;
+/// Rate of the motion control loop
+constexpr const int CONTROL_LOOP_HZ = 1000;
+
+/// The control loop has the second core to itself, above everything but the
+/// system tasks
+constexpr const int CONTROL_LOOP_CORE = 1;
+constexpr const int CONTROL_LOOP_PRIORITY = 20;
+
+/// How often the motion task looks for manual changes while idle
+constexpr const int STATUS_REFRESH_MS = 20;
+
+/// Event notifications: at most EVENT_BURST at once, then one per
+/// EVENT_INTERVAL_MS
+constexpr const int EVENT_BURST = 4;
+constexpr const int EVENT_INTERVAL_MS = 100;
+
+/// How often queued log messages are printed
+constexpr const int LOG_DRAIN_MS = 20;
+
+/// Shortest run of a case in the 'bench' command
+constexpr const int MICROBENCH_MIN_MS = 50;
+
+/// Default timeout for the 'wait' command
+constexpr const int MAX_JOB_WAIT_MS = 60000;
+
+/// Number of pulses moved to check a restored calibration
+constexpr const int VALIDATION_PULSES = 3;
+
+/// Number of ms to let the motor come to rest after backing off
+constexpr const int BACKOFF_SETTLE_MS = 50;
 
 /// Keys for NVS (keep short)
 constexpr const char* DEFAULT_POWER_KEY =     "default_pwr";
@@ -40,5 +72,6 @@ extern Encoder encoder;
 extern Led led;
 extern int default_motor_power;
 extern int backoff_pulses;
+/// Distance actually moved by the last backoff
+extern int last_backoff_pulses;
 
-void verbose_printf(const char* format, ...);
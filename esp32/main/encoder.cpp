@@ -4,14 +4,23 @@
 #include <driver/periph_ctrl.h>
 #include <driver/pcnt.h>
 #include <driver/timer.h>
+#include <esp_timer.h>
+
+#include <algorithm>
 
 #define PCNT_H_LIM_VAL      1000
 #define PCNT_L_LIM_VAL     -1000
 
-QueueHandle_t Encoder::pcnt_evt_queue = nullptr;
+// Edges closer than this to the previous one are taken to be bounces.
+// Matches the PCNT filter.
+constexpr int EDGE_FILTER_US = 375;
+
+static bool isr_service_installed = false;
 
 Encoder::Encoder(pcnt_unit_t _unit, int gpio1, int gpio2)
-    : unit(_unit)
+    : unit(_unit),
+      pin_a((gpio_num_t) gpio1),
+      pin_b((gpio_num_t) gpio2)
 {
     pcnt_config_t pcnt_config;
     pcnt_config.pulse_gpio_num = gpio1;
@@ -38,14 +47,16 @@ Encoder::Encoder(pcnt_unit_t _unit, int gpio1, int gpio2)
     pcnt_counter_pause(unit);
     pcnt_counter_clear(unit);
 
-    // Initialize PCNT event queue and PCNT functions
-    if (!pcnt_evt_queue)
+    if (!isr_service_installed)
     {
-        pcnt_evt_queue = xQueueCreate(10, sizeof(pcnt_evt_t));
         ESP_ERROR_CHECK(pcnt_isr_service_install(0));
+        isr_service_installed = true;
     }
     pcnt_isr_handler_add(unit, quad_enc_isr, this);
 
+    target_sem = xSemaphoreCreateBinary();
+    assert(target_sem);
+
     pcnt_set_filter_value(unit, 30000); // 0.375 milliseconds
     pcnt_filter_enable(unit);
 
@@ -53,35 +64,230 @@ Encoder::Encoder(pcnt_unit_t _unit, int gpio1, int gpio2)
     pcnt_event_enable(unit, PCNT_EVT_L_LIM);
 
     pcnt_counter_resume(unit);
+
+    // The PCNT inputs also interrupt on every edge, to time the steps
+    const auto err = gpio_install_isr_service(0);
+    if (err != ESP_ERR_INVALID_STATE) // already installed
+        ESP_ERROR_CHECK(err);
+    ESP_ERROR_CHECK(gpio_set_intr_type(pin_a, GPIO_INTR_ANYEDGE));
+    ESP_ERROR_CHECK(gpio_set_intr_type(pin_b, GPIO_INTR_ANYEDGE));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(pin_a, &edge_isr_a, this));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(pin_b, &edge_isr_b, this));
+    ESP_ERROR_CHECK(gpio_intr_enable(pin_a));
+    ESP_ERROR_CHECK(gpio_intr_enable(pin_b));
 }
 
 void Encoder::set_zero()
 {
+    set_position(0);
+}
+
+void Encoder::set_position(int64_t position)
+{
+    pcnt_counter_pause(unit);
     ESP_ERROR_CHECK(pcnt_counter_clear(unit));
+    // No limit can be reached while paused, so the ISR will not interfere
+    add_accumulated(position - get_accumulated());
+    pcnt_counter_resume(unit);
+}
+
+bool Encoder::arm_target(int64_t position, void (*on_reached)(void*), void* arg)
+{
+    disarm_watch();
+    disarm_target();
+    // Drain any stale notification
+    xSemaphoreTake(target_sem, 0);
+
+    // The threshold is compared against the raw counter, so it must be
+    // strictly inside the limits
+    const auto count = position - get_accumulated();
+    if (count <= PCNT_L_LIM_VAL || count >= PCNT_H_LIM_VAL)
+        return false;
+
+    target_callback = on_reached;
+    target_arg = arg;
+    target_armed = true;
+    ESP_ERROR_CHECK(pcnt_set_event_value(unit, PCNT_EVT_THRES_0, (int16_t) count));
+    ESP_ERROR_CHECK(pcnt_event_enable(unit, PCNT_EVT_THRES_0));
+    return true;
+}
+
+void Encoder::disarm_target()
+{
+    target_armed = false;
+    ESP_ERROR_CHECK(pcnt_event_disable(unit, PCNT_EVT_THRES_0));
+}
+
+bool Encoder::arm_watch(int64_t low, int64_t high, void (*on_leave)(void*), void* arg)
+{
+    disarm_watch();
+    disarm_target();
+
+    // Leaving the window means reaching the count just outside either edge
+    const auto acc = get_accumulated();
+    const auto below = low - 1 - acc;
+    const auto above = high + 1 - acc;
+    if (below <= PCNT_L_LIM_VAL || above >= PCNT_H_LIM_VAL)
+        return false;
+
+    watch_callback = on_leave;
+    watch_arg = arg;
+    ESP_ERROR_CHECK(pcnt_set_event_value(unit, PCNT_EVT_THRES_0, (int16_t) below));
+    ESP_ERROR_CHECK(pcnt_set_event_value(unit, PCNT_EVT_THRES_1, (int16_t) above));
+    watch_armed = true;
+    watch_enabled = true;
+    ESP_ERROR_CHECK(pcnt_event_enable(unit, PCNT_EVT_THRES_0));
+    ESP_ERROR_CHECK(pcnt_event_enable(unit, PCNT_EVT_THRES_1));
+
+    // The knob may have moved past an edge before the events were enabled
+    const auto pos = poll();
+    if (pos < low || pos > high)
+    {
+        disarm_watch();
+        return false;
+    }
+    return true;
+}
+
+void Encoder::disarm_watch()
+{
+    if (!watch_enabled)
+        return;
+    // The callback is left in place, as the ISR may be about to call it
+    watch_armed = false;
+    watch_enabled = false;
+    ESP_ERROR_CHECK(pcnt_event_disable(unit, PCNT_EVT_THRES_0));
+    ESP_ERROR_CHECK(pcnt_event_disable(unit, PCNT_EVT_THRES_1));
+}
+
+bool Encoder::is_watch_armed() const
+{
+    return watch_armed;
+}
+
+bool Encoder::wait_for_target(TickType_t ticks)
+{
+    return xSemaphoreTake(target_sem, ticks) == pdTRUE;
+}
+
+int Encoder::get_edges(Edge* out, int n) const
+{
+    n = std::min(n, EDGE_HISTORY/2);
+    while (true)
+    {
+        const auto head = edge_head.load(std::memory_order_acquire);
+        const int count = std::min<uint32_t>(n, head);
+        for (int i = 0; i < count; ++i)
+            out[i] = edges[(head - 1 - i) % EDGE_HISTORY];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Retry if the ISR may have overwritten what was copied
+        if (edge_head.load(std::memory_order_relaxed) - head <= (uint32_t) (EDGE_HISTORY - n))
+            return count;
+    }
+}
+
+double Encoder::get_velocity() const
+{
+    Edge e[2];
+    if (get_edges(e, 2) < 2)
+        return 0;
+    // The speed can be no more than one step since the last edge
+    const auto since_us = esp_timer_get_time() - e[0].time_us;
+    const auto interval_us = std::max<int64_t>(e[0].time_us - e[1].time_us, since_us);
+    return e[0].dir * 1e6 / std::max<int64_t>(interval_us, 1);
+}
+
+double Encoder::get_acceleration() const
+{
+    Edge e[3];
+    if (get_edges(e, 3) < 3)
+        return 0;
+    const double v_prev = e[1].dir * 1e6 / std::max<int64_t>(e[1].time_us - e[2].time_us, 1);
+    const double mid_us = (e[0].time_us - e[2].time_us)/2.0;
+    return (get_velocity() - v_prev) * 1e6 / std::max(mid_us, 1.0);
+}
+
+void IRAM_ATTR Encoder::add_edge(int dir)
+{
+    const auto now = esp_timer_get_time();
+    const auto head = edge_head.load(std::memory_order_relaxed);
+    if (head && now - edges[(head - 1) % EDGE_HISTORY].time_us < EDGE_FILTER_US)
+        return;
+    edges[head % EDGE_HISTORY] = { now, dir };
+    edge_head.store(head + 1, std::memory_order_release);
+}
+
+// Step direction follows the PCNT configuration: an edge on A counts up when
+// A and B are equal afterwards, an edge on B when they differ.
+
+void IRAM_ATTR Encoder::edge_isr_a(void* arg)
+{
+    auto enc = (Encoder*) arg;
+    enc->add_edge(gpio_get_level(enc->pin_a) == gpio_get_level(enc->pin_b) ? 1 : -1);
+}
+
+void IRAM_ATTR Encoder::edge_isr_b(void* arg)
+{
+    auto enc = (Encoder*) arg;
+    enc->add_edge(gpio_get_level(enc->pin_a) != gpio_get_level(enc->pin_b) ? 1 : -1);
+}
+
+int64_t Encoder::get_accumulated() const
+{
+    while (true)
+    {
+        const auto seq = sequence.load(std::memory_order_acquire);
+        const int64_t acc = accumulated;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && seq == sequence.load(std::memory_order_relaxed))
+            return acc;
+    }
+}
+
+void IRAM_ATTR Encoder::add_accumulated(int64_t delta)
+{
+    const auto seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    accumulated = accumulated + delta;
+    sequence.store(seq + 2, std::memory_order_release);
 }
 
 int64_t Encoder::poll()
 {
-    /* Wait for the event information passed from PCNT's interrupt handler.
-     * Once received, decode the event type and print it on the serial monitor.
-     */
-    pcnt_evt_t evt;
-    auto res = xQueueReceive(pcnt_evt_queue, &evt, 0);
-    if (res == pdTRUE)
+    // Retry if an overflow was accounted for while reading the counter
+    while (true)
     {
-        auto enc = (Encoder*) evt.enc;
-        //printf("Status %d\n", evt.status);
-        if (evt.status & PCNT_EVT_L_LIM) {
-            enc->accumulated += PCNT_L_LIM_VAL;
-        }
-        if (evt.status & PCNT_EVT_H_LIM) {
-            enc->accumulated += PCNT_H_LIM_VAL;
+        const auto seq = sequence.load(std::memory_order_acquire);
+        const int64_t acc = accumulated;
+        int16_t count;
+        pcnt_get_counter_value(unit, &count);
+        uint32_t status = 0;
+        pcnt_get_event_status(unit, &status);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((seq & 1) || seq != sequence.load(std::memory_order_relaxed))
+            continue;
+
+        // The hardware resets the counter at a limit a few microseconds
+        // before quad_enc_isr() adds the limit to 'accumulated'. In between,
+        // the counter has jumped back by a whole limit since the last read
+        // with the same 'accumulated', with that limit as the latest event.
+        // No real movement between two reads comes near that, so count the
+        // limit here, and keep the result until the ISR has run.
+        const auto last = last_count.load(std::memory_order_relaxed);
+        int corrected = count;
+        if ((last >> 16) == (seq & 0xFFFF))
+        {
+            const int16_t last_value = (int16_t) (last & 0xFFFF);
+            if ((status & PCNT_EVT_H_LIM) && last_value - count > PCNT_H_LIM_VAL/2)
+                corrected += PCNT_H_LIM_VAL;
+            else if ((status & PCNT_EVT_L_LIM) && count - last_value > -PCNT_L_LIM_VAL/2)
+                corrected += PCNT_L_LIM_VAL;
         }
+        last_count.store(((seq & 0xFFFF) << 16) | (uint16_t) corrected,
+                         std::memory_order_relaxed);
+        return corrected + acc;
     }
-
-    int16_t temp_count;
-    pcnt_get_counter_value(unit, &temp_count);
-    return temp_count + accumulated;
 }
 
 void IRAM_ATTR Encoder::quad_enc_isr(void* arg)
@@ -90,15 +296,36 @@ void IRAM_ATTR Encoder::quad_enc_isr(void* arg)
 
     uint32_t status = 0;
     pcnt_get_event_status(enc->unit, &status);
+    portBASE_TYPE HPTaskAwoken = pdFALSE;
     if ((status & PCNT_EVT_L_LIM) ||
         (status & PCNT_EVT_H_LIM))
     {
-        pcnt_evt_t evt;
-        evt.enc = enc;
-        evt.status = status;
-        portBASE_TYPE HPTaskAwoken = pdFALSE;
-        xQueueSendFromISR(pcnt_evt_queue, &evt, &HPTaskAwoken);
-        if (HPTaskAwoken == pdTRUE)
-            portYIELD_FROM_ISR();
+        if (status & PCNT_EVT_L_LIM)
+            enc->add_accumulated(PCNT_L_LIM_VAL);
+        if (status & PCNT_EVT_H_LIM)
+            enc->add_accumulated(PCNT_H_LIM_VAL);
+        // The counter has been reset, so an armed threshold no longer matches the target
+        enc->target_armed = false;
+        // but a limit is far outside any watched window
+        if (enc->watch_armed)
+        {
+            enc->watch_armed = false;
+            enc->watch_callback(enc->watch_arg);
+        }
+    }
+    else if ((status & PCNT_EVT_THRES_0) && enc->target_armed)
+    {
+        enc->target_armed = false;
+        if (enc->target_callback)
+            enc->target_callback(enc->target_arg);
+        xSemaphoreGiveFromISR(enc->target_sem, &HPTaskAwoken);
+    }
+    else if ((status & (PCNT_EVT_THRES_0 | PCNT_EVT_THRES_1)) && enc->watch_armed)
+    {
+        // The events stay enabled until disarm_watch(), but are ignored
+        enc->watch_armed = false;
+        enc->watch_callback(enc->watch_arg);
     }
+    if (HPTaskAwoken == pdTRUE)
+        portYIELD_FROM_ISR();
 }
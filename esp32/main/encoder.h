@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
+
 #include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <driver/gpio.h>
 #include <driver/pcnt.h>
 
 class Encoder
@@ -9,29 +12,109 @@ class Encoder
 public:
     // 50 steps per revolution
     static constexpr int STEPS_PER_REVOLUTION = 50;
+
+    /// A single encoder step
+    struct Edge
+    {
+        /// esp_timer_get_time() of the edge
+        int64_t time_us;
+        /// Direction of the step (+1 or -1, same sign as poll())
+        int dir;
+    };
+
+    /// Number of edges kept
+    static constexpr int EDGE_HISTORY = 32;
     
     Encoder(pcnt_unit_t unit,
             int gpio1, int gpio2);
 
+    /// Current position. Lock-free and callable from any task.
     int64_t poll();
 
     void set_zero();
+
+    /// Make the current position read as 'position'.
+    void set_position(int64_t position);
+
+    /// Arm a PCNT threshold event at 'position'. When the encoder reaches it,
+    /// 'on_reached' (if any) is called from the ISR and wait_for_target() returns.
+    /// Return false if the position is too far away for the counter to see it.
+    bool arm_target(int64_t position, void (*on_reached)(void*) = nullptr, void* arg = nullptr);
+
+    void disarm_target();
+
+    /// Call 'on_leave' from the ISR the first time the position leaves
+    /// [low, high], using both PCNT threshold events, so that a bolt at rest
+    /// is watched without polling. Cancelled by arm_target(). Return false if
+    /// the window is too far away for the counter to see, or the position is
+    /// already outside it.
+    bool arm_watch(int64_t low, int64_t high, void (*on_leave)(void*), void* arg = nullptr);
+
+    void disarm_watch();
+
+    bool is_watch_armed() const;
+
+    /// Wait at most 'ticks' for the armed target. Return true if it was reached.
+    bool wait_for_target(TickType_t ticks);
+
+    /// Copy up to 'n' of the most recent edges, newest first. Return the number copied.
+    int get_edges(Edge* out, int n) const;
+
+    /// Instantaneous velocity (pulses/s), from the time between the last two
+    /// edges. Decays towards zero when no edges are seen.
+    double get_velocity() const;
+
+    /// Acceleration (pulses/s^2), from the last three edges.
+    double get_acceleration() const;
     
 private:
-    struct pcnt_evt_t
-    {
-        Encoder* enc = 0;
-        uint32_t status = 0;
-    };
-
     static void IRAM_ATTR quad_enc_isr(void*);
 
+    static void IRAM_ATTR edge_isr_a(void*);
+
+    static void IRAM_ATTR edge_isr_b(void*);
+
+    void IRAM_ATTR add_edge(int dir);
+
+    /// Consistent read of 'accumulated'
+    int64_t get_accumulated() const;
+
+    /// Add to 'accumulated' (from the ISR, or with the ISR unable to run)
+    void IRAM_ATTR add_accumulated(int64_t delta);
+
     pcnt_unit_t unit = (pcnt_unit_t) 0;
-    
-    // A queue to handle pulse counter events
-    static QueueHandle_t pcnt_evt_queue;
+    gpio_num_t pin_a = (gpio_num_t) 0;
+    gpio_num_t pin_b = (gpio_num_t) 0;
+
+    /// Sum of counter overflows, maintained by the ISR. The counter is only
+    /// 16 bits and is reset each time it reaches a limit.
+    volatile int64_t accumulated = 0;
+
+    /// Sequence counter guarding 'accumulated', which cannot be read or written
+    /// atomically: odd while an update is in progress.
+    std::atomic<uint32_t> sequence{0};
+
+    /// Counter value of the last poll(), in the low 16 bits, and the low 16
+    /// bits of 'sequence' it was read with, in the high ones: tells poll()
+    /// that the counter was reset at a limit before the ISR has accounted for
+    /// it.
+    std::atomic<uint32_t> last_count{0};
+
+    /// Edge ring buffer, written by the GPIO ISRs. 'edge_head' counts all
+    /// edges ever written.
+    Edge edges[EDGE_HISTORY];
+    std::atomic<uint32_t> edge_head{0};
+
+    volatile bool target_armed = false;
+    void (*target_callback)(void*) = nullptr;
+    void* target_arg = nullptr;
+    SemaphoreHandle_t target_sem = nullptr;
 
-    int64_t accumulated = 0;
+    volatile bool watch_armed = false;
+    /// The threshold events are enabled for the watch, even if it has fired
+    bool watch_enabled = false;
+    void (*watch_callback)(void*) = nullptr;
+    void* watch_arg = nullptr;
 };
 
 extern Encoder encoder;
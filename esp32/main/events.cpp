@@ -0,0 +1,88 @@
+#include "events.h"
+
+#include "defines.h"
+#include "protocol.h"
+
+static const EventKind kinds[] = { EVENT_STATE, EVENT_DOOR, EVENT_HANDLE, EVENT_WARNING };
+
+static int kind_index(EventKind kind)
+{
+    return kind == EVENT_STATE ? 0 : kind == EVENT_DOOR ? 1 : kind == EVENT_HANDLE ? 2 : 3;
+}
+
+void EventNotifier::update(const StatusSnapshot& s,
+                           int64_t door_change_time_us, int64_t handle_change_time_us)
+{
+    if (!m_has_last)
+    {
+        m_last = s;
+        m_has_last = true;
+        m_tokens = EVENT_BURST;
+        m_refill_time_us = s.time_us;
+        return;
+    }
+    const auto mask = m_mask.load();
+    auto mark = [&](EventKind kind, bool changed, int64_t time_us)
+    {
+        if (!changed || !(mask & kind))
+            return;
+        if (m_pending & kind)
+            ++m_coalesced;
+        m_pending |= kind;
+        m_pending_time_us[kind_index(kind)] = time_us;
+    };
+    mark(EVENT_STATE, s.state != m_last.state, s.time_us);
+    mark(EVENT_DOOR, s.door_closed != m_last.door_closed, door_change_time_us);
+    mark(EVENT_HANDLE, s.handle_raised != m_last.handle_raised, handle_change_time_us);
+    mark(EVENT_WARNING, s.warning != m_last.warning, s.time_us);
+    m_last = s;
+
+    while (m_tokens < EVENT_BURST && s.time_us - m_refill_time_us >= EVENT_INTERVAL_MS*1000LL)
+    {
+        ++m_tokens;
+        m_refill_time_us += EVENT_INTERVAL_MS*1000LL;
+    }
+    if (m_tokens == EVENT_BURST)
+        m_refill_time_us = s.time_us;
+
+    for (auto kind : kinds)
+    {
+        if (!(m_pending & kind) || !m_tokens)
+            continue;
+        // Report the current value: a change and its reversal may have
+        // been merged
+        const uint8_t value = kind == EVENT_STATE ? (uint8_t) s.state :
+            kind == EVENT_DOOR ? s.door_closed :
+            kind == EVENT_HANDLE ? s.handle_raised : s.warning;
+        send(kind, value, m_pending_time_us[kind_index(kind)]);
+        m_pending &= ~kind;
+        --m_tokens;
+    }
+}
+
+void EventNotifier::send(EventKind kind, uint8_t value, int64_t time_us)
+{
+    Frame frame;
+    frame.command = FRAME_EVENT;
+    frame.sequence = m_sequence++;
+    frame.put_u8(kind);
+    frame.put_u8(value);
+    frame.put_i32(m_last.position);
+    frame.put_u32(time_us/1000);
+    frame_send(frame);
+}
+
+void EventNotifier::set_mask(uint8_t mask)
+{
+    m_mask = mask;
+}
+
+uint8_t EventNotifier::get_mask() const
+{
+    return m_mask;
+}
+
+uint32_t EventNotifier::get_coalesced() const
+{
+    return m_coalesced;
+}
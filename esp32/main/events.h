@@ -0,0 +1,57 @@
+#pragma once
+
+#include "status.h"
+
+#include <atomic>
+#include <cstdint>
+
+/// Kinds of event, also used as bits in the subscription mask
+enum EventKind : uint8_t
+{
+    /// Value: State
+    EVENT_STATE = 0x01,
+    /// Value: 1 if the door is closed
+    EVENT_DOOR = 0x02,
+    /// Value: 1 if the handle is raised
+    EVENT_HANDLE = 0x04,
+    /// Value: 1 if the auto-lock warning is on
+    EVENT_WARNING = 0x08,
+};
+
+/// Sends an unsolicited FRAME_EVENT whenever the published status changes.
+///
+/// Events are rate limited by a token bucket. A change that arrives while
+/// the bucket is empty is not queued; instead its kind is marked as pending
+/// and reported with the then current value once a token is available, so
+/// the host always ends up with the latest status.
+class EventNotifier
+{
+public:
+    /// Look for changes in a newly published snapshot. Only the publishing
+    /// task may call this.
+    void update(const StatusSnapshot& snapshot,
+                int64_t door_change_time_us, int64_t handle_change_time_us);
+
+    /// Select the EventKinds to send. Nothing is sent until this is called.
+    void set_mask(uint8_t mask);
+
+    uint8_t get_mask() const;
+
+    /// Number of changes merged into a later event by the rate limit.
+    uint32_t get_coalesced() const;
+
+private:
+    void send(EventKind kind, uint8_t value, int64_t time_us);
+
+    std::atomic<uint8_t> m_mask{0};
+    std::atomic<uint32_t> m_coalesced{0};
+    bool m_has_last = false;
+    StatusSnapshot m_last;
+    uint8_t m_pending = 0;
+    int64_t m_pending_time_us[4] = {};
+    int m_tokens = 0;
+    int64_t m_refill_time_us = 0;
+    uint8_t m_sequence = 0;
+};
+
+extern EventNotifier event_notifier;
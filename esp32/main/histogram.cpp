@@ -0,0 +1,111 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+int Histogram::get_bucket(int64_t us)
+{
+    int bucket = 0;
+    while (us > 0 && bucket < BUCKETS - 1)
+    {
+        us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void Histogram::add(int64_t us)
+{
+    if (us < 0)
+        us = 0;
+    if (reset_requested.load(std::memory_order_acquire))
+    {
+        for (auto& c : counts)
+            c.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(INT64_MAX, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+        reset_requested.store(false, std::memory_order_release);
+    }
+    counts[get_bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(us, std::memory_order_relaxed);
+    // Single writer, so no compare-and-swap is needed
+    if (us < min.load(std::memory_order_relaxed))
+        min.store(us, std::memory_order_relaxed);
+    if (us > max.load(std::memory_order_relaxed))
+        max.store(us, std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    reset_requested.store(true, std::memory_order_release);
+}
+
+bool Histogram::is_reset_pending() const
+{
+    return reset_requested.load(std::memory_order_acquire);
+}
+
+uint32_t Histogram::get_count() const
+{
+    return is_reset_pending() ? 0 : count.load(std::memory_order_relaxed);
+}
+
+int64_t Histogram::get_min() const
+{
+    return get_count() ? min.load(std::memory_order_relaxed) : 0;
+}
+
+int64_t Histogram::get_max() const
+{
+    return is_reset_pending() ? 0 : max.load(std::memory_order_relaxed);
+}
+
+int64_t Histogram::get_average() const
+{
+    const auto n = get_count();
+    return n ? sum.load(std::memory_order_relaxed)/n : 0;
+}
+
+int64_t Histogram::get_percentile(double fraction) const
+{
+    if (is_reset_pending())
+        return 0;
+    uint32_t total = 0;
+    for (const auto& c : counts)
+        total += c.load(std::memory_order_relaxed);
+    const auto wanted = (uint32_t) (fraction*total);
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen > wanted || seen == total)
+            // The bucket bound may be well above anything actually seen
+            return i == BUCKETS - 1 ? get_max() : std::min((int64_t(1) << i) - 1, get_max());
+    }
+    return get_max();
+}
+
+void Histogram::print(const char* name, const char* unit) const
+{
+    printf("%s: count %u min %lld avg %lld p95 %lld max %lld %s\n",
+           name, (unsigned) get_count(),
+           (long long) get_min(), (long long) get_average(),
+           (long long) get_percentile(0.95), (long long) get_max(), unit);
+    if (is_reset_pending())
+        return;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        const auto n = counts[i].load(std::memory_order_relaxed);
+        if (!n)
+            continue;
+        const int64_t low = i ? int64_t(1) << (i - 1) : 0;
+        const int64_t high = (int64_t(1) << i) - 1;
+        if (i == BUCKETS - 1)
+            printf("%s: %lld- %s %u\n", name, (long long) low, unit, (unsigned) n);
+        else
+            printf("%s: %lld-%lld %s %u\n", name, (long long) low, (long long) high, unit, (unsigned) n);
+    }
+}
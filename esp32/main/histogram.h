@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// Histogram of durations in microseconds (or other non-negative values),
+/// with power-of-two buckets: bucket 0 holds 0 us, bucket n holds
+/// [2^(n-1), 2^n) us, and the last bucket everything above.
+/// Written by a single task; may be read, and reset, from any.
+class Histogram
+{
+public:
+    static constexpr int BUCKETS = 24;
+
+    void add(int64_t us);
+
+    /// Ask for the values to be cleared. The writer clears them on its next
+    /// add(), so a reset never races with an add() in progress; until then
+    /// the histogram reads as empty.
+    void reset();
+
+    uint32_t get_count() const;
+
+    int64_t get_min() const;
+
+    int64_t get_max() const;
+
+    int64_t get_average() const;
+
+    /// Upper bound of the bucket below which 'fraction' of the values lie
+    int64_t get_percentile(double fraction) const;
+
+    /// Print a summary line for 'name', followed by a line for each
+    /// non-empty bucket.
+    void print(const char* name, const char* unit = "us") const;
+
+private:
+    static int get_bucket(int64_t us);
+
+    bool is_reset_pending() const;
+
+    std::atomic<uint32_t> counts[BUCKETS] = {};
+    std::atomic<uint32_t> count{0};
+    std::atomic<int64_t> sum{0};
+    std::atomic<int64_t> min{INT64_MAX};
+    std::atomic<int64_t> max{0};
+    std::atomic<bool> reset_requested{false};
+};
@@ -0,0 +1,123 @@
+#include "job_queue.h"
+
+#include <esp_attr.h>
+#include <freertos/task.h>
+
+void JobQueue::start(void (*_idle)(), int idle_ms)
+{
+    idle = _idle;
+    idle_ticks = idle_ms/portTICK_PERIOD_MS;
+    queue = xQueueCreate(MAX_QUEUED, sizeof(Job));
+    done_sem = xSemaphoreCreateBinary();
+    wake_sem = xSemaphoreCreateBinary();
+    submit_mutex = xSemaphoreCreateMutex();
+    if (idle)
+        idle();
+    // Above the console, so that typing cannot delay a move
+    xTaskCreate(task, "motion_task", 4*1024, this, 6, NULL);
+}
+
+uint32_t JobQueue::submit(void (*run)(const Job&), int arg0, int arg1)
+{
+    // Held until the job is queued, so that ids are handed out in queue order
+    xSemaphoreTake(submit_mutex, portMAX_DELAY);
+    Job job;
+    job.id = next_id.load();
+    job.run = run;
+    job.args[0] = arg0;
+    job.args[1] = arg1;
+    const bool ok = xQueueSend(queue, &job, 0) == pdTRUE;
+    if (ok)
+        next_id.store(job.id + 1);
+    xSemaphoreGive(submit_mutex);
+    if (ok)
+        xSemaphoreGive(wake_sem);
+    return ok ? job.id : 0;
+}
+
+void IRAM_ATTR JobQueue::wake_from_isr()
+{
+    // Not through the queue, so that a busy knob cannot fill it up. Any
+    // number of wakes before the task runs make one.
+    portBASE_TYPE woken = pdFALSE;
+    xSemaphoreGiveFromISR(wake_sem, &woken);
+    if (woken == pdTRUE)
+        portYIELD_FROM_ISR();
+}
+
+void JobQueue::abort()
+{
+    abort_below.store(next_id.load());
+    // Queued jobs are skipped by the task, so they still get reported as aborted
+}
+
+bool JobQueue::is_abort_requested() const
+{
+    return running_id.load() < abort_below.load();
+}
+
+bool JobQueue::is_busy() const
+{
+    return finished_id.load() + 1 < next_id.load();
+}
+
+uint32_t JobQueue::get_last_id() const
+{
+    return next_id.load() - 1;
+}
+
+JobQueue::Status JobQueue::get_status(uint32_t id) const
+{
+    if (id == 0 || id >= next_id.load())
+        return Unknown;
+    if (id == running_id.load())
+        return Running;
+    const auto finished = finished_id.load();
+    if (id > finished)
+        return Queued;
+    if (finished - id >= HISTORY)
+        return Unknown;
+    return aborted[id % HISTORY].load() ? Aborted : Done;
+}
+
+bool JobQueue::wait(uint32_t id, TickType_t ticks)
+{
+    const auto start = xTaskGetTickCount();
+    while (finished_id.load() < id)
+    {
+        const auto elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= ticks)
+            return false;
+        xSemaphoreTake(done_sem, ticks - elapsed);
+    }
+    return true;
+}
+
+void JobQueue::task(void* arg)
+{
+    auto self = static_cast<JobQueue*>(arg);
+    while (true)
+    {
+        Job job;
+        if (xQueueReceive(self->queue, &job, 0) != pdTRUE)
+        {
+            // Woken by submit() or wake_from_isr(), or at the idle interval
+            xSemaphoreTake(self->wake_sem, self->idle_ticks);
+            if (xQueueReceive(self->queue, &job, 0) != pdTRUE)
+            {
+                if (self->idle)
+                    self->idle();
+                continue;
+            }
+        }
+        self->running_id.store(job.id);
+        if (!self->is_abort_requested())
+            job.run(job);
+        self->aborted[job.id % HISTORY].store(self->is_abort_requested());
+        self->finished_id.store(job.id);
+        self->running_id.store(0);
+        if (self->idle)
+            self->idle();
+        xSemaphoreGive(self->done_sem);
+    }
+}
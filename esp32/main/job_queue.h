@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+/// Runs motion commands one at a time in a task of its own, so that the
+/// console stays responsive while the motor is running. All motor commands
+/// must go through here.
+class JobQueue
+{
+public:
+    struct Job
+    {
+        uint32_t id;
+        void (*run)(const Job& job);
+        int args[2];
+    };
+
+    enum Status
+    {
+        Queued,
+        Running,
+        Done,
+        Aborted,
+        /// Too old to be remembered, or never submitted
+        Unknown
+    };
+
+    /// Number of jobs that can be waiting
+    static constexpr int MAX_QUEUED = 8;
+
+    /// Number of finished jobs whose status is remembered
+    static constexpr int HISTORY = 16;
+
+    /// Create the queue and start the task. 'idle' is called once before the
+    /// task starts, then by the task between jobs and at least every 'idle_ms'
+    /// while there are none.
+    void start(void (*idle)(), int idle_ms);
+
+    /// Queue 'run', to be called with 'arg0' and 'arg1' in Job::args.
+    /// Return the job id, or 0 if the queue is full.
+    uint32_t submit(void (*run)(const Job&), int arg0 = 0, int arg1 = 0);
+
+    /// Make the task call 'idle' now instead of at the next interval, unless
+    /// it is busy. Callable from an ISR.
+    void wake_from_isr();
+
+    /// Abort the running job and drop all queued jobs.
+    void abort();
+
+    /// True if the job being run has been aborted. Motion loops must check
+    /// this and stop the motor.
+    bool is_abort_requested() const;
+
+    /// True while a job is queued or running.
+    bool is_busy() const;
+
+    /// Id of the last job submitted.
+    uint32_t get_last_id() const;
+
+    Status get_status(uint32_t id) const;
+
+    /// Wait at most 'ticks' for job 'id' to finish. Return false on timeout.
+    bool wait(uint32_t id, TickType_t ticks);
+
+private:
+    static void task(void* arg);
+
+    QueueHandle_t queue = nullptr;
+    void (*idle)() = nullptr;
+    TickType_t idle_ticks = portMAX_DELAY;
+    /// Given each time a job finishes
+    SemaphoreHandle_t done_sem = nullptr;
+    /// Given by submit() and wake_from_isr() to wake the task
+    SemaphoreHandle_t wake_sem = nullptr;
+    /// The console and the motion task (AutoLock) both submit
+    SemaphoreHandle_t submit_mutex = nullptr;
+    std::atomic<uint32_t> next_id{1};
+    std::atomic<uint32_t> running_id{0};
+    std::atomic<uint32_t> finished_id{0};
+    /// Jobs with lower ids are aborted
+    std::atomic<uint32_t> abort_below{0};
+    /// Outcome of the last HISTORY jobs, indexed by id
+    std::atomic<bool> aborted[HISTORY];
+};
+
+extern JobQueue jobs;
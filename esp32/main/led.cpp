@@ -1,7 +1,6 @@
 #include "led.h"
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include <algorithm>
 
 Led::Led(gpio_num_t _pin)
     : pin(_pin)
@@ -21,32 +20,73 @@ Led::Led(gpio_num_t _pin)
     ESP_ERROR_CHECK(gpio_config(&io_conf));
     mutex_handle =  xSemaphoreCreateMutex();
     assert(mutex_handle);
+
+    esp_timer_create_args_t args = {};
+    args.callback = &timer_callback;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "led";
+    args.skip_unhandled_events = true;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
 }
 
 void Led::set_params(int num, int den, int period_ms)
+{
+    const int on = std::min(num + 1, den);
+    const Step pattern[] = {
+        { true, on * period_ms },
+        { false, (den - on) * period_ms }
+    };
+    set_sequence(pattern, 2);
+}
+
+void Led::set_blink(int on_ms, int off_ms)
+{
+    const Step pattern[] = {
+        { true, on_ms },
+        { false, off_ms }
+    };
+    set_sequence(pattern, 2);
+}
+
+void Led::set_sequence(const Step* new_steps, int n)
 {
     xSemaphoreTake(mutex_handle, portMAX_DELAY);
-    duty_cycle_num = num;
-    duty_cycle_den = den;
-    period = period_ms;
+    esp_timer_stop(timer);
+    // Zero-length steps are dropped
+    nof_steps = 0;
+    for (int i = 0; i < n && nof_steps < MAX_STEPS; ++i)
+        if (new_steps[i].ms > 0)
+            steps[nof_steps++] = new_steps[i];
+    current = 0;
+    start_step();
     xSemaphoreGive(mutex_handle);
 }
 
-void Led::update()
+void Led::start_step()
 {
-    const auto now = xTaskGetTickCount()*portTICK_PERIOD_MS;
-    const auto elapsed = now - last_tick;
-    xSemaphoreTake(mutex_handle, portMAX_DELAY);
-    if (elapsed < period)
+    if (nof_steps == 0)
     {
-        xSemaphoreGive(mutex_handle);
+        ESP_ERROR_CHECK(gpio_set_level(pin, 0));
         return;
     }
-    last_tick = now;
-    if (cycle >= duty_cycle_den)
-        cycle = 0;
-    const bool is_on = (cycle <= duty_cycle_num);
-    xSemaphoreGive(mutex_handle);
-    ++cycle;
-    ESP_ERROR_CHECK(gpio_set_level(pin, is_on));
+    ESP_ERROR_CHECK(gpio_set_level(pin, steps[current].on));
+    // A single step is a steady level
+    if (nof_steps == 1)
+        return;
+    const int64_t duration_us = steps[current].ms * 1000LL;
+    step_end_us = esp_timer_get_time() + duration_us;
+    ESP_ERROR_CHECK(esp_timer_start_once(timer, duration_us));
+}
+
+void Led::timer_callback(void* arg)
+{
+    auto self = (Led*) arg;
+    xSemaphoreTake(self->mutex_handle, portMAX_DELAY);
+    if (esp_timer_get_time() >= self->step_end_us && self->nof_steps > 1)
+    {
+        self->current = (self->current + 1) % self->nof_steps;
+        self->start_step();
+    }
+    xSemaphoreGive(self->mutex_handle);
 }
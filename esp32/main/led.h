@@ -1,24 +1,45 @@
 #pragma once
 
 #include <driver/gpio.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
+/// Status LED driven by a one-shot esp_timer that fires only at the edges
+/// of the current pattern, so a steady pattern costs no CPU time.
 class Led
 {
 public:
-    Led(gpio_num_t _pin);
+    struct Step
+    {
+        bool on;
+        int ms;
+    };
+
+    static constexpr int MAX_STEPS = 8;
 
-    void update();
+    Led(gpio_num_t _pin);
 
+    /// Turn on for 'num' + 1 out of every 'den' periods of 'period_ms'.
     void set_params(int num, int den, int period_ms);
 
+    void set_blink(int on_ms, int off_ms);
+
+    /// Repeat a sequence of up to MAX_STEPS steps.
+    void set_sequence(const Step* steps, int nof_steps);
+
 private:
+    static void timer_callback(void* arg);
+
+    void start_step();
+
     gpio_num_t pin = (gpio_num_t) 0;
-    int period = 1;
-    int duty_cycle_num = 1;
-    int duty_cycle_den = 100;
-    unsigned long last_tick = 0;
-    int cycle = 0;
+    Step steps[MAX_STEPS];
+    int nof_steps = 0;
+    int current = 0;
+    /// When the current step ends. Used to ignore a callback that fired
+    /// just before the pattern was changed.
+    int64_t step_end_us = 0;
+    esp_timer_handle_t timer = nullptr;
     SemaphoreHandle_t mutex_handle = (SemaphoreHandle_t) 0;
 };
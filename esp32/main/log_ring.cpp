@@ -0,0 +1,148 @@
+#include "log_ring.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+LogRing::LogRing()
+{
+    for (uint32_t i = 0; i < SIZE; ++i)
+        records[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+void LogRing::start(int interval_ms)
+{
+    interval_ticks = interval_ms/portTICK_PERIOD_MS;
+    // Below everything else, so that printing never delays real work
+    xTaskCreate(task, "log_task", 3*1024, this, 1, NULL);
+}
+
+void LogRing::push(const char* format, const Arg* args, int nargs)
+{
+    const auto time_us = esp_timer_get_time();
+    auto pos = head.load(std::memory_order_relaxed);
+    Record* record = nullptr;
+    while (true)
+    {
+        record = &records[pos % SIZE];
+        const auto diff = (int32_t) (record->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            // Free: claim it
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // Still holds a record from the previous lap
+            ++dropped;
+            return;
+        }
+        else
+            pos = head.load(std::memory_order_relaxed);
+    }
+    record->time_us = time_us;
+    record->format = format;
+    record->nargs = nargs;
+    for (int i = 0; i < nargs; ++i)
+        record->args[i] = args[i];
+    record->sequence.store(pos + 1, std::memory_order_release);
+}
+
+uint32_t LogRing::get_dropped() const
+{
+    return dropped.load();
+}
+
+void LogRing::task(void* arg)
+{
+    auto self = reinterpret_cast<LogRing*>(arg);
+    while (true)
+    {
+        self->drain();
+        vTaskDelay(self->interval_ticks);
+    }
+}
+
+void LogRing::drain()
+{
+    while (true)
+    {
+        auto& record = records[tail % SIZE];
+        if (record.sequence.load(std::memory_order_acquire) != tail + 1)
+            break;
+        print(record);
+        record.sequence.store(tail + SIZE, std::memory_order_release);
+        ++tail;
+    }
+    const auto n = dropped.load();
+    if (n != reported_dropped)
+    {
+        printf("DEBUG: %u messages dropped\n", (unsigned) (n - reported_dropped));
+        reported_dropped = n;
+    }
+}
+
+void LogRing::print(const Record& record)
+{
+    printf("DEBUG: %ld ", (long) (record.time_us/1000));
+    const char* p = record.format;
+    int next_arg = 0;
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+        // Copy one conversion specification and print the argument with it
+        const size_t len = strcspn(p + 1, "diouxXcspfeEgG") + 2;
+        char spec[16];
+        if (len >= sizeof(spec) || !p[len - 1] || next_arg >= record.nargs)
+        {
+            // Malformed, or not enough arguments
+            fputs(p, stdout);
+            break;
+        }
+        memcpy(spec, p, len);
+        spec[len] = 0;
+        const auto conversion = spec[len - 1];
+        const auto is_long_long = strstr(spec, "ll") != nullptr;
+        const auto is_long = !is_long_long && strchr(spec, 'l') != nullptr;
+        const auto& arg = record.args[next_arg++];
+        switch (conversion)
+        {
+        case 's':
+        case 'p':
+            printf(spec, arg.p);
+            break;
+        case 'f':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            printf(spec, arg.type == Arg::Double ? arg.d : (double) arg.i);
+            break;
+        default:
+            // Integers are stored sign or zero extended, so the low bits are
+            // right for any width
+            if (is_long_long)
+                printf(spec, arg.i);
+            else if (is_long)
+                printf(spec, (long) arg.i);
+            else
+                printf(spec, (int) arg.i);
+            break;
+        }
+        p += len;
+    }
+}
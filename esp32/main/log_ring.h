@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// Deferred logging. A log record holds the time, the format string and
+/// the raw arguments; it is formatted and printed later by a low-priority
+/// task, so that logging from a motion loop costs a few hundred ns instead
+/// of the time it takes to send a line to the UART.
+///
+/// Only the format pointer is stored, so formats must be string literals,
+/// and so must any "%s" arguments.
+class LogRing
+{
+public:
+    static constexpr int MAX_ARGS = 4;
+
+    LogRing();
+
+    struct Arg
+    {
+        enum Type : uint8_t { Int, Unsigned, Pointer, Double };
+
+        Type type;
+        union
+        {
+            long long i;
+            unsigned long long u;
+            const void* p;
+            double d;
+        };
+    };
+
+    /// Start the task that prints the records.
+    void start(int interval_ms);
+
+    /// Add a record, or count it as dropped if the ring is full. Safe to
+    /// call from any task.
+    void push(const char* format, const Arg* args, int nargs);
+
+    /// Number of records dropped because the ring was full.
+    uint32_t get_dropped() const;
+
+private:
+    static constexpr uint32_t SIZE = 64;
+
+    struct Record
+    {
+        /// Equal to the position being written once the slot is free, and
+        /// one more than that once it has been written
+        std::atomic<uint32_t> sequence;
+        int64_t time_us;
+        const char* format;
+        uint8_t nargs;
+        Arg args[MAX_ARGS];
+    };
+
+    static void task(void* arg);
+
+    /// Print all pending records.
+    void drain();
+
+    static void print(const Record& record);
+
+    Record records[SIZE];
+    std::atomic<uint32_t> head{0};
+    uint32_t tail = 0;
+    std::atomic<uint32_t> dropped{0};
+    uint32_t reported_dropped = 0;
+    int interval_ticks = 1;
+};
+
+extern LogRing log_ring;
+extern int verbosity;
+
+inline LogRing::Arg make_log_arg(long long value)
+{
+    LogRing::Arg arg;
+    arg.type = LogRing::Arg::Int;
+    arg.i = value;
+    return arg;
+}
+
+inline LogRing::Arg make_log_arg(int value)
+{
+    return make_log_arg((long long) value);
+}
+
+inline LogRing::Arg make_log_arg(long value)
+{
+    return make_log_arg((long long) value);
+}
+
+inline LogRing::Arg make_log_arg(unsigned long long value)
+{
+    LogRing::Arg arg;
+    arg.type = LogRing::Arg::Unsigned;
+    arg.u = value;
+    return arg;
+}
+
+inline LogRing::Arg make_log_arg(unsigned value)
+{
+    return make_log_arg((unsigned long long) value);
+}
+
+inline LogRing::Arg make_log_arg(unsigned long value)
+{
+    return make_log_arg((unsigned long long) value);
+}
+
+inline LogRing::Arg make_log_arg(double value)
+{
+    LogRing::Arg arg;
+    arg.type = LogRing::Arg::Double;
+    arg.d = value;
+    return arg;
+}
+
+inline LogRing::Arg make_log_arg(const void* value)
+{
+    LogRing::Arg arg;
+    arg.type = LogRing::Arg::Pointer;
+    arg.p = value;
+    return arg;
+}
+
+/// Log a message if verbosity is set. See LogRing.
+template<typename... Args>
+void verbose_printf(const char* format, Args... args)
+{
+    static_assert(sizeof...(args) <= LogRing::MAX_ARGS, "Too many arguments for verbose_printf");
+    if (verbosity == 0)
+        return;
+    const LogRing::Arg packed[sizeof...(args) + 1] = { make_log_arg(args)... };
+    log_ring.push(format, packed, sizeof...(args));
+}
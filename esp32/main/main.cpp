@@ -1,7 +1,15 @@
+#include "auto_lock.h"
+#include "control_loop.h"
 #include "defines.h"
 #include "encoder.h"
+#include "events.h"
+#include "job_queue.h"
 #include "led.h"
+#include "log_ring.h"
+#include "motion_stats.h"
+#include "motion_trace.h"
 #include "motor.h"
+#include "status.h"
 #include "switches.h"
 
 #include <stdio.h>
@@ -15,15 +23,24 @@
 #include "nvs_flash.h"
 
 extern "C" void console_task(void*);
-extern "C" void switch_task(void*);
+void refresh_status();
 
 Encoder encoder(PCNT_UNIT_0, ENC_A, ENC_B);
 Led led(LED);
 Motor* motor = nullptr;
 Switches switches;
+AutoLock auto_lock;
+JobQueue jobs;
+ControlLoop control_loop;
+StatusPublisher status_publisher;
+EventNotifier event_notifier;
+LogRing log_ring;
+MotionStats motion_stats;
+MotionTrace motion_trace;
 
 int default_motor_power = MOTOR_DEFAULT_POWER;
 int backoff_pulses = DEFAULT_BACKOFF_PULSES;
+int last_backoff_pulses = 0;
 
 extern "C" void app_main()
 {
@@ -65,6 +82,7 @@ extern "C" void app_main()
         break;
     }
     nvs_close(my_handle);
+    auto_lock.load();
     
     motor = new Motor(AIN1, AIN2, PWMA, STBY);
 
@@ -74,6 +92,8 @@ extern "C" void app_main()
     printf("Danalock " VERSION " ready, default power: %d, backoff: %d\n",
            default_motor_power, backoff_pulses);
     
+    log_ring.start(LOG_DRAIN_MS);
+    control_loop.start(CONTROL_LOOP_HZ, CONTROL_LOOP_CORE, CONTROL_LOOP_PRIORITY);
+    jobs.start(&refresh_status, STATUS_REFRESH_MS);
     xTaskCreate(console_task, "console_task", 4*1024, NULL, 5, NULL);
-    xTaskCreate(switch_task, "switch_task", 4*1024, NULL, 5, NULL);
 }
@@ -0,0 +1,85 @@
+#include "microbench.h"
+
+#include "defines.h"
+#include "status.h"
+#include "switches.h"
+
+#include <esp_console.h>
+
+// In console.cpp; they are only meant to be called by the motion task
+void update_state();
+bool format_status(const StatusSnapshot& s, char* buf, size_t size);
+
+// Keeps the compiler from optimising the calls away
+static volatile int sink;
+
+static void encoder_poll()
+{
+    sink = encoder.poll();
+}
+
+static void switches_update()
+{
+    switches.update();
+}
+
+static void bench_update_state()
+{
+    update_state();
+}
+
+static void console_dispatch()
+{
+    // Not a command, so this is splitting the line and searching all
+    // commands, without running one
+    int ret = 0;
+    sink = esp_console_run("no_such_command 1 2", &ret);
+}
+
+static void status_format()
+{
+    char buf[64];
+    sink = format_status(status_publisher.read(), buf, sizeof(buf));
+}
+
+struct Case
+{
+    MicrobenchTask task;
+    const char* name;
+    void (*run)();
+};
+
+static const Case cases[] = {
+    { MICROBENCH_MOTION, "encoder_poll", &encoder_poll },
+    { MICROBENCH_MOTION, "switches_update", &switches_update },
+    { MICROBENCH_MOTION, "update_state", &bench_update_state },
+    { MICROBENCH_CONSOLE, "console_dispatch", &console_dispatch },
+    { MICROBENCH_CONSOLE, "status_format", &status_format },
+};
+
+// Stop growing at this, in case the clock does not run
+constexpr uint32_t MAX_ITERATIONS = 100000000;
+
+void microbench_run(MicrobenchTask task, FILE* out, uint32_t (*clock)(), const char* unit,
+                    uint32_t min_time)
+{
+    for (const auto& c : cases)
+    {
+        if (c.task != task)
+            continue;
+        uint32_t iterations = 1;
+        uint32_t elapsed = 0;
+        while (true)
+        {
+            const auto start = clock();
+            for (uint32_t i = 0; i < iterations; ++i)
+                c.run();
+            elapsed = clock() - start;
+            if (elapsed >= min_time || iterations >= MAX_ITERATIONS)
+                break;
+            iterations *= 10;
+        }
+        fprintf(out, "BENCH %-20s %10.1f %-6s %10u\n",
+                c.name, (double) elapsed/iterations, unit, (unsigned) iterations);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+/// Microbenchmarks of the code run on every control tick, status refresh
+/// or console command. The same cases run on the target, timed by the CPU
+/// cycle counter ('bench' command), and on the host (bench_micro).
+///
+/// Each case is run 1, 10, 100... times until a run takes at least
+/// 'min_time', and reported on 'out' as one line per case:
+///
+///   BENCH <case> <time per call> <unit> <iterations>
+///
+/// 'clock' must count up in 'unit' and may wrap.
+///
+/// The cases are split by the task they must be run in: those of the motion
+/// task touch the encoder, the switches and the lock state, and
+/// esp_console_run() is not reentrant, so it must only ever be called by the
+/// console task.
+enum MicrobenchTask
+{
+    MICROBENCH_MOTION,
+    MICROBENCH_CONSOLE
+};
+
+/// Run the cases meant for 'task'.
+void microbench_run(MicrobenchTask task, FILE* out, uint32_t (*clock)(), const char* unit,
+                    uint32_t min_time);
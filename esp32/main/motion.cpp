@@ -0,0 +1,78 @@
+#include "motion.h"
+#include "defines.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Feed forward from the measured speed/power relation (see rotate()):
+// about 0.035 pulses/s per unit of power above a dead zone of 115.
+constexpr double SPEED_PER_POWER = 0.035;
+constexpr int DEAD_ZONE_POWER = 115;
+
+// PI gains, in power per pulse/s of speed error
+constexpr double KP = 10;
+constexpr double KI = 20;
+
+// Definitions of the class constants, needed in C++11 when they are bound
+// to a reference, as by std::min()
+constexpr double MotionController::CRUISE_SPEED;
+constexpr double MotionController::APPROACH_SPEED;
+constexpr double MotionController::ACCELERATION;
+
+MotionController::MotionController(Motor& _motor, Encoder& _encoder)
+    : motor(_motor),
+      encoder(_encoder)
+{
+}
+
+void MotionController::start(bool _fwd, int64_t _start_pos, int _steps, int _max_power, int64_t now_us)
+{
+    fwd = _fwd;
+    start_pos = _start_pos;
+    steps = _steps;
+    max_power = _max_power;
+    last_update_us = now_us;
+    speed = 0;
+    ref_speed = APPROACH_SPEED;
+    integral = 0;
+}
+
+void MotionController::update(int64_t pos, int64_t now_us)
+{
+    const double dt = (now_us - last_update_us)/1e6;
+    last_update_us = now_us;
+
+    speed = fabs(encoder.get_velocity());
+
+    const int remaining = steps - (int) std::llabs(pos - start_pos);
+    // The target has been reached, and the motor braked by whoever saw it first
+    if (remaining <= 0)
+        return;
+    ref_speed = std::min(ref_speed + ACCELERATION*dt, CRUISE_SPEED);
+    ref_speed = std::min(ref_speed, sqrt(APPROACH_SPEED*APPROACH_SPEED + 2*ACCELERATION*std::max(0, remaining)));
+
+    const double error = ref_speed - speed;
+    const int ff = get_feed_forward(ref_speed);
+    // Only integrate while not saturated
+    const double out = ff + KP*error + KI*(integral + error*dt);
+    if (out > 0 && out < max_power)
+        integral += error*dt;
+    const int power = std::min(std::max((int) (ff + KP*error + KI*integral), 0), max_power);
+    motor.drive(fwd ? power : -power);
+}
+
+double MotionController::get_speed() const
+{
+    return speed;
+}
+
+double MotionController::get_reference_speed() const
+{
+    return ref_speed;
+}
+
+int MotionController::get_feed_forward(double s) const
+{
+    return DEAD_ZONE_POWER + (int) (s/SPEED_PER_POWER);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "encoder.h"
+#include "motor.h"
+
+#include <cstdint>
+
+/// Closed-loop speed controller for a move of a known number of pulses.
+/// The speed follows a trapezoidal profile: accelerate to cruise speed,
+/// cruise, then decelerate so as to arrive at the target at approach speed.
+class MotionController
+{
+public:
+    /// Cruise speed (pulses/s)
+    static constexpr double CRUISE_SPEED = 25;
+
+    /// Speed at which the target is reached (pulses/s)
+    static constexpr double APPROACH_SPEED = 4;
+
+    /// Acceleration and deceleration (pulses/s^2)
+    static constexpr double ACCELERATION = 40;
+
+    MotionController(Motor& motor, Encoder& encoder);
+
+    /// Begin controlling a move of 'steps' pulses from 'start_pos' in the
+    /// direction given by 'fwd'. Call once the mechanism has engaged.
+    void start(bool fwd, int64_t start_pos, int steps, int max_power, int64_t now_us);
+
+    /// Update motor power from the measured speed. Call at regular intervals.
+    /// Does nothing once the target has been reached.
+    void update(int64_t pos, int64_t now_us);
+
+    /// Measured speed (pulses/s)
+    double get_speed() const;
+
+    /// Speed the profile currently asks for (pulses/s)
+    double get_reference_speed() const;
+
+private:
+    int get_feed_forward(double speed) const;
+
+    Motor& motor;
+    Encoder& encoder;
+    bool fwd = true;
+    int64_t start_pos = 0;
+    int steps = 0;
+    int max_power = 0;
+    int64_t last_update_us = 0;
+    double speed = 0;
+    double ref_speed = 0;
+    double integral = 0;
+};
@@ -0,0 +1,80 @@
+#include "motion_stats.h"
+
+#include "defines.h"
+
+#include <cstdio>
+
+#include <esp_timer.h>
+
+static const char* operation_names[MotionStats::OPERATIONS] = {
+    "lock", "unlock", "calibrate"
+};
+
+static const char* phase_names[MotionStats::PHASES] = {
+    "engage", "travel", "overshoot", "backoff", "total"
+};
+
+void MotionStats::begin(Operation op)
+{
+    operation = op;
+    is_running = true;
+    start_us = esp_timer_get_time();
+}
+
+void MotionStats::end()
+{
+    if (!is_running)
+        return;
+    add(Total, esp_timer_get_time() - start_us);
+    is_running = false;
+}
+
+void MotionStats::add(Phase phase, int64_t value)
+{
+    if (is_running)
+        histograms[operation][phase].add(value);
+}
+
+void MotionStats::set_stop(int target, bool fwd)
+{
+    if (!is_running)
+        return;
+    is_stop_pending = true;
+    stop_operation = operation;
+    stop_target = target;
+    stop_fwd = fwd;
+    stop_us = esp_timer_get_time();
+}
+
+void MotionStats::check_stop(int pos)
+{
+    if (!is_stop_pending || esp_timer_get_time() - stop_us < BACKOFF_SETTLE_MS*1000LL)
+        return;
+    is_stop_pending = false;
+    // Positive power makes the encoder count down
+    const int overshoot = stop_fwd ? stop_target - pos : pos - stop_target;
+    // A bolt that stopped short counts as no overshoot
+    histograms[stop_operation][Overshoot].add(overshoot > 0 ? overshoot : 0);
+}
+
+void MotionStats::print() const
+{
+    printf("OK: motion stats\n");
+    for (int op = 0; op < OPERATIONS; ++op)
+        for (int phase = 0; phase < PHASES; ++phase)
+        {
+            const auto& h = histograms[op][phase];
+            if (!h.get_count())
+                continue;
+            char name[32];
+            snprintf(name, sizeof(name), "%s %s", operation_names[op], phase_names[phase]);
+            h.print(name, phase == Overshoot ? "pulses" : "us");
+        }
+}
+
+void MotionStats::reset()
+{
+    for (auto& row : histograms)
+        for (auto& h : row)
+            h.reset();
+}
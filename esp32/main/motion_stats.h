@@ -0,0 +1,86 @@
+#pragma once
+
+#include "histogram.h"
+
+#include <cstdint>
+
+/// Timing of the phases of the motion commands, for the 'stats' command.
+/// Only the motion task records; anyone may print.
+class MotionStats
+{
+public:
+    enum Operation
+    {
+        Lock,
+        Unlock,
+        Calibrate,
+        OPERATIONS
+    };
+
+    enum Phase
+    {
+        /// From power on to the first encoder pulse
+        Engage,
+        /// From the first pulse to the target or the end stop
+        Travel,
+        /// Pulses past the target once the bolt has come to rest
+        Overshoot,
+        /// Reversing away from an end stop, including settling
+        Backoff,
+        /// The whole command
+        Total,
+        PHASES
+    };
+
+    /// Start timing 'op'. Phases are recorded for it until end().
+    void begin(Operation op);
+
+    void end();
+
+    /// Times an operation for as long as it is in scope
+    class Scope
+    {
+    public:
+        Scope(MotionStats& stats, Operation op)
+            : stats(stats)
+        {
+            stats.begin(op);
+        }
+
+        ~Scope()
+        {
+            stats.end();
+        }
+
+    private:
+        MotionStats& stats;
+    };
+
+    /// Record 'value' (us, or pulses for Overshoot) for the current operation.
+    void add(Phase phase, int64_t value);
+
+    /// Note that the motor was stopped for 'target'; the overshoot is
+    /// measured by check_stop() once the bolt has had time to settle.
+    void set_stop(int target, bool fwd);
+
+    /// Called regularly while idle.
+    void check_stop(int pos);
+
+    void print() const;
+
+    void reset();
+
+private:
+    Histogram histograms[OPERATIONS][PHASES];
+    Operation operation = Lock;
+    bool is_running = false;
+    int64_t start_us = 0;
+
+    bool is_stop_pending = false;
+    Operation stop_operation = Lock;
+    int stop_target = 0;
+    bool stop_fwd = false;
+    int64_t stop_us = 0;
+};
+
+extern MotionStats motion_stats;
@@ -0,0 +1,156 @@
+#include "motion_trace.h"
+
+#include "control_loop.h"
+#include "defines.h"
+#include "switches.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <esp_timer.h>
+
+// Bytes per line of a dump; 64 characters of base64
+static constexpr int DUMP_LINE_BYTES = 48;
+
+static void print_base64_line(const uint8_t* data, int length)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char line[DUMP_LINE_BYTES/3*4 + 1];
+    int n = 0;
+    for (int i = 0; i < length; i += 3)
+    {
+        const uint32_t b = (data[i] << 16) |
+            (i + 1 < length ? data[i + 1] << 8 : 0) |
+            (i + 2 < length ? data[i + 2] : 0);
+        line[n++] = alphabet[(b >> 18) & 0x3F];
+        line[n++] = alphabet[(b >> 12) & 0x3F];
+        line[n++] = i + 1 < length ? alphabet[(b >> 6) & 0x3F] : '=';
+        line[n++] = i + 2 < length ? alphabet[b & 0x3F] : '=';
+    }
+    line[n] = 0;
+    printf("TRACE: %s\n", line);
+}
+
+void MotionTrace::begin(char operation, uint32_t job_id)
+{
+    const auto n = next_trace.load();
+    auto& trace = traces[n % TRACES];
+    trace.operation = operation;
+    trace.job_id = job_id;
+    trace.start_us = esp_timer_get_time();
+    trace.first = next_sample.load();
+    trace.last = trace.first;
+    start_us = trace.start_us;
+    next_trace.store(n + 1);
+    is_recording.store(true, std::memory_order_release);
+    control_loop.set_tracing(true);
+}
+
+void MotionTrace::end()
+{
+    // A sample being taken right now may be left out
+    is_recording.store(false);
+    traces[(next_trace.load() - 1) % TRACES].last = next_sample.load();
+    control_loop.set_tracing(false);
+}
+
+void MotionTrace::sample(int64_t now_us, bool controlled)
+{
+    if (!is_recording.load(std::memory_order_acquire))
+        return;
+    const auto trace = next_trace.load(std::memory_order_relaxed);
+    const int16_t position = encoder.poll();
+    const uint8_t flags = (switches.is_door_closed() ? DOOR_CLOSED : 0) |
+        (switches.is_handle_raised() ? HANDLE_RAISED : 0) |
+        (controlled ? CONTROLLED : 0);
+    // Always keep the first sample of a trace
+    if (trace == last_trace && position == last_position && flags == last_flags &&
+        now_us - last_time_us < SAMPLE_INTERVAL_MS*1000)
+        return;
+    last_trace = trace;
+    last_time_us = now_us;
+    last_position = position;
+    last_flags = flags;
+
+    const auto index = next_sample.load(std::memory_order_relaxed);
+    auto& s = samples[index % SAMPLES];
+    s.time_ms = (now_us - start_us)/1000;
+    s.position = position;
+    s.power = motor->get_power();
+    s.flags = flags;
+    memset(s.reserved, 0, sizeof(s.reserved));
+    next_sample.store(index + 1, std::memory_order_release);
+}
+
+bool MotionTrace::get_trace(int index, Trace& trace) const
+{
+    const auto n = next_trace.load();
+    if (index < 0 || index >= TRACES || (uint32_t) index >= n)
+        return false;
+    const bool is_latest = index == 0;
+    trace = traces[(n - 1 - index) % TRACES];
+    const auto next = next_sample.load(std::memory_order_acquire);
+    if (is_latest && is_recording.load())
+        trace.last = next;
+    return true;
+}
+
+void MotionTrace::list() const
+{
+    const auto n = next_trace.load();
+    printf("OK: %d traces\n", (int) (n < TRACES ? n : TRACES));
+    for (int i = 0; i < TRACES; ++i)
+    {
+        Trace trace;
+        if (!get_trace(i, trace))
+            break;
+        const auto next = next_sample.load();
+        const auto oldest = next > SAMPLES ? next - SAMPLES : 0;
+        const auto first = trace.first > oldest ? trace.first : oldest;
+        const auto count = trace.last > first ? trace.last - first : 0;
+        printf("%d: %c job %u at %lld ms, %u samples, %u lost\n",
+               i, trace.operation, (unsigned) trace.job_id, (long long) (trace.start_us/1000),
+               (unsigned) count, (unsigned) (trace.last - trace.first - count));
+    }
+}
+
+bool MotionTrace::dump(int index) const
+{
+    Trace trace;
+    if (!get_trace(index, trace))
+        return false;
+    const auto next = next_sample.load();
+    const auto oldest = next > SAMPLES ? next - SAMPLES : 0;
+    const auto first = trace.first > oldest ? trace.first : oldest;
+    const auto count = trace.last > first ? trace.last - first : 0;
+
+    Header header;
+    header.magic[0] = 'T';
+    header.magic[1] = 'R';
+    header.version = FORMAT_VERSION;
+    header.operation = trace.operation;
+    header.job_id = trace.job_id;
+    header.start_ms = trace.start_us/1000;
+    header.count = count;
+    header.lost = trace.last - trace.first - count;
+    print_base64_line(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+
+    // Samples can be overwritten by a new motion while this is being
+    // printed, so check each line after copying it
+    uint8_t line[DUMP_LINE_BYTES];
+    constexpr int per_line = DUMP_LINE_BYTES/sizeof(Sample);
+    for (uint32_t i = first; i < first + count; i += per_line)
+    {
+        const int n = first + count - i < per_line ? first + count - i : per_line;
+        for (int j = 0; j < n; ++j)
+            memcpy(line + j*sizeof(Sample), &samples[(i + j) % SAMPLES], sizeof(Sample));
+        if (next_sample.load(std::memory_order_acquire) - i > SAMPLES)
+        {
+            printf("ERROR: trace overwritten during dump\n");
+            return true;
+        }
+        print_base64_line(line, n*sizeof(Sample));
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/// Records what the mechanism does during each motion job. While a trace
+/// is open, the control loop runs and offers a sample every cycle; one is
+/// kept when the position or the flags have changed, and otherwise every
+/// SAMPLE_INTERVAL_MS. All traces share one ring of samples, so the oldest
+/// traces, or the start of a long one, are the first to go.
+///
+/// A dumped trace is a Header followed by Header::count Samples, little
+/// endian, sent as base64 in lines of "TRACE: " followed by 64 characters
+/// or less. Each line decodes on its own. esp32/host/trace_decode turns a
+/// dump into CSV.
+class MotionTrace
+{
+public:
+    /// Enough for TRACES lock and unlock motions, or a calibration and a
+    /// few of them
+    static constexpr int SAMPLES = 4096;
+    static constexpr int TRACES = 8;
+    static constexpr int SAMPLE_INTERVAL_MS = 10;
+    static constexpr uint8_t FORMAT_VERSION = 2;
+
+    enum SampleFlags : uint8_t
+    {
+        DOOR_CLOSED = 0x01,
+        HANDLE_RAISED = 0x02,
+        /// The speed controller was setting the power
+        CONTROLLED = 0x04,
+    };
+
+    struct Sample
+    {
+        /// Since the start of the trace
+        uint32_t time_ms;
+        int16_t position;
+        /// Signed motor power, 0 when braked
+        int16_t power;
+        uint8_t flags;
+        uint8_t reserved[3];
+    };
+
+    struct Header
+    {
+        char magic[2];
+        uint8_t version;
+        /// First letter of the job: 'L'ock, 'U'nlock, 'C'alibrate,
+        /// 'R'otate, 'D'rive
+        char operation;
+        uint32_t job_id;
+        /// esp_timer_get_time()/1000 at the start
+        uint32_t start_ms;
+        uint32_t count;
+        /// Samples at the start of the trace that have been overwritten
+        uint32_t lost;
+    };
+
+    static_assert(sizeof(Sample) == 12, "Sample must be packed");
+    static_assert(sizeof(Header) == 20, "Header must be packed");
+
+    /// Open a trace. Called by the motion task.
+    void begin(char operation, uint32_t job_id);
+
+    void end();
+
+    /// Called by the control loop every cycle.
+    void sample(int64_t now_us, bool controlled);
+
+    /// Print a line for each trace still held.
+    void list() const;
+
+    /// Dump trace 'index' (0 is the latest). Return false if there is no
+    /// such trace.
+    bool dump(int index) const;
+
+    /// Records a trace for as long as it is in scope
+    class Scope
+    {
+    public:
+        Scope(MotionTrace& trace, char operation, uint32_t job_id)
+            : trace(trace)
+        {
+            trace.begin(operation, job_id);
+        }
+
+        ~Scope()
+        {
+            trace.end();
+        }
+
+    private:
+        MotionTrace& trace;
+    };
+
+private:
+    struct Trace
+    {
+        char operation = 0;
+        uint32_t job_id = 0;
+        int64_t start_us = 0;
+        /// Index of the first sample, counting from the first ever taken
+        uint32_t first = 0;
+        /// One past the last sample, once the trace has ended
+        uint32_t last = 0;
+    };
+
+    /// Get trace 'index' (0 is the latest) and its current sample range.
+    bool get_trace(int index, Trace& trace) const;
+
+    Sample samples[SAMPLES];
+    /// Number of samples ever taken
+    std::atomic<uint32_t> next_sample{0};
+    Trace traces[TRACES];
+    /// Number of traces ever begun
+    std::atomic<uint32_t> next_trace{0};
+    std::atomic<bool> is_recording{false};
+    int64_t start_us = 0;
+
+    // The last sample kept, only used by sample()
+    uint32_t last_trace = 0;
+    int64_t last_time_us = 0;
+    int16_t last_position = 0;
+    uint8_t last_flags = 0;
+};
+
+extern MotionTrace motion_trace;
@@ -61,17 +61,6 @@ int Motor::get_max_engage_time_ms(int pwr) const
     return ms;
 }
 
-int Motor::get_backoff_time_ms(int pwr)
-{
-    int ms = BACKOFF_MS; // heuristically determined to be suitable at power = 300
-
-    int abs_pwr = abs(pwr);
-    if (abs_pwr > 400)
-        ms = BACKOFF_MS/2;
-
-    return ms;
-}
-
 int Motor::get_rotation_timeout_ms(int pwr) const
 {
     int ms = 275;
@@ -86,6 +75,7 @@ int Motor::get_rotation_timeout_ms(int pwr) const
 void Motor::drive(int speed)
 {
     ESP_ERROR_CHECK(gpio_set_level(Standby, 1));
+    power = speed;
     if (speed >= 0)
         fwd(speed);
     else
@@ -110,12 +100,26 @@ void Motor::rev(int speed)
 
 void Motor::brake()
 {
+    power = 0;
     ESP_ERROR_CHECK(gpio_set_level(In1, 1));
     ESP_ERROR_CHECK(gpio_set_level(In2, 1));
     ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0));
     ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0));
 }
 
+void IRAM_ATTR Motor::brake_from_isr()
+{
+    // With both inputs high the driver short-brakes regardless of PWM
+    power = 0;
+    gpio_set_level(In1, 1);
+    gpio_set_level(In2, 1);
+}
+
+int Motor::get_power() const
+{
+    return power;
+}
+
 void Motor::standby()
 {
     ESP_ERROR_CHECK(gpio_set_level(Standby, 0));
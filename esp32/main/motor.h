@@ -1,6 +1,9 @@
 #pragma once
 
 #include "driver/gpio.h"
+#include "esp_attr.h"
+
+#include <atomic>
 
 class Motor
 {
@@ -10,9 +13,6 @@ public:
     /// Get maximum time to wait for engaging.
     int get_max_engage_time_ms(int pwr) const;
     
-    /// Get time to wait for backoff.
-    static int get_backoff_time_ms(int pwr);
-    
     /// Get maximum time to wait for movement.
     int get_rotation_timeout_ms(int pwr) const;
     
@@ -21,9 +21,16 @@ public:
 
     // Stop motor by setting both input pins high
     void brake(); 
+
+    // As brake(), but safe to call from an ISR. The PWM duty is left as is;
+    // brake() must still be called from the task to clear it.
+    void IRAM_ATTR brake_from_isr();
     
     // Set the chip to standby mode.
     void standby(); 
+
+    // Power last set by drive(), or 0 if braked since.
+    int get_power() const;
     
 private:
     gpio_num_t In1 = (gpio_num_t) 0;
@@ -34,4 +41,5 @@ private:
     void fwd(int speed);
     void rev(int speed);
     int max_engage_time_ms = 0;
+    std::atomic<int> power{0};
 };
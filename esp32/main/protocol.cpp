@@ -0,0 +1,117 @@
+#include "protocol.h"
+
+#include <sdkconfig.h>
+#include <driver/uart.h>
+
+static constexpr uart_port_t UART_NUM = (uart_port_t) CONFIG_ESP_CONSOLE_UART_NUM;
+
+// A frame that has not arrived within this time is dropped
+static constexpr int FRAME_TIMEOUT_MS = 100;
+
+static frame_handler_t handlers[256];
+
+void Frame::put_u8(uint8_t value)
+{
+    if (length < FRAME_MAX_PAYLOAD)
+        payload[length++] = value;
+}
+
+void Frame::put_u16(uint16_t value)
+{
+    put_u8(value);
+    put_u8(value >> 8);
+}
+
+void Frame::put_u32(uint32_t value)
+{
+    put_u16(value);
+    put_u16(value >> 16);
+}
+
+void Frame::put_i32(int32_t value)
+{
+    put_u32((uint32_t) value);
+}
+
+uint32_t Frame::get_u32(size_t offset) const
+{
+    return payload[offset] |
+        (payload[offset + 1] << 8) |
+        (payload[offset + 2] << 16) |
+        ((uint32_t) payload[offset + 3] << 24);
+}
+
+uint16_t crc16_ccitt(const uint8_t* data, size_t length, uint16_t crc)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+void frame_register(uint8_t command, frame_handler_t handler)
+{
+    handlers[command] = handler;
+}
+
+void frame_send(const Frame& frame)
+{
+    uint8_t buf[4 + FRAME_MAX_PAYLOAD + 2];
+    buf[0] = FRAME_SYNC;
+    buf[1] = frame.length;
+    buf[2] = frame.command;
+    buf[3] = frame.sequence;
+    for (size_t i = 0; i < frame.length; ++i)
+        buf[4 + i] = frame.payload[i];
+    const auto crc = crc16_ccitt(buf + 1, 3 + frame.length);
+    buf[4 + frame.length] = crc;
+    buf[5 + frame.length] = crc >> 8;
+    // Bypass stdio, which would translate line endings. A single write is
+    // not interleaved with other output.
+    uart_write_bytes(UART_NUM, (const char*) buf, 6 + frame.length);
+}
+
+void frame_handle()
+{
+    const auto timeout = FRAME_TIMEOUT_MS/portTICK_PERIOD_MS;
+    uint8_t header[3];
+    if (uart_read_bytes(UART_NUM, header, sizeof(header), timeout) != sizeof(header))
+        return;
+    Frame request;
+    request.length = header[0];
+    request.command = header[1];
+    request.sequence = header[2];
+
+    Frame reply;
+    reply.command = request.command | FRAME_REPLY;
+    reply.sequence = request.sequence;
+    if (request.length > FRAME_MAX_PAYLOAD)
+    {
+        // Do not try to read it; the rest will be taken as garbage text
+        reply.put_u8(FRAME_BAD_LENGTH);
+        frame_send(reply);
+        return;
+    }
+    uint8_t crc_bytes[2];
+    if ((request.length &&
+         uart_read_bytes(UART_NUM, request.payload, request.length, timeout) != request.length) ||
+        uart_read_bytes(UART_NUM, crc_bytes, sizeof(crc_bytes), timeout) != sizeof(crc_bytes))
+        return;
+    auto crc = crc16_ccitt(header, sizeof(header));
+    crc = crc16_ccitt(request.payload, request.length, crc);
+    if (crc != (crc_bytes[0] | (crc_bytes[1] << 8)))
+    {
+        reply.put_u8(FRAME_BAD_CRC);
+        frame_send(reply);
+        return;
+    }
+
+    const auto handler = handlers[request.command];
+    reply.put_u8(handler ? FRAME_OK : FRAME_UNKNOWN_COMMAND);
+    if (handler)
+        handler(request, reply);
+    frame_send(reply);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Framed binary protocol, sharing the console UART with the text commands.
+///
+/// Every frame, in either direction, is
+///
+///   SYNC  length  command  sequence  payload[length]  crc16 (little endian)
+///
+/// where the CRC (CCITT, initial value 0xFFFF) covers everything from
+/// 'length' to the end of the payload. SYNC is not a printable character,
+/// so it cannot begin a text command.
+///
+/// A reply carries the command with FRAME_REPLY set, the sequence number of
+/// the request, and a payload that begins with a FrameResult. Requests are
+/// answered in order as soon as they have been read, so a host may send
+/// several without waiting for the replies. All multi-byte values are
+/// little endian. Text output, such as the result of a job, may appear
+/// between frames, so a host should look for SYNC before each reply.
+
+constexpr uint8_t FRAME_SYNC = 0xA5;
+constexpr uint8_t FRAME_REPLY = 0x80;
+constexpr size_t FRAME_MAX_PAYLOAD = 32;
+
+enum FrameCommand : uint8_t
+{
+    /// Reply: nothing
+    FRAME_PING = 0x01,
+    /// Reply: state u8, flags u8 (FRAME_STATUS_*), position i32, age of the
+    /// snapshot in us u32
+    FRAME_STATUS = 0x02,
+    /// Reply: position i32, velocity in pulses/1000 s i32, acceleration in
+    /// pulses/1000 s^2 i32, last backoff distance u16
+    FRAME_TELEMETRY = 0x03,
+    /// Reply: job id u32
+    FRAME_LOCK = 0x10,
+    FRAME_UNLOCK = 0x11,
+    FRAME_CALIBRATE = 0x12,
+    /// Reply: nothing
+    FRAME_ABORT = 0x13,
+    /// Request: job id u32. Reply: JobQueue::Status u8
+    FRAME_JOB_STATUS = 0x14,
+    /// Request: mask of EventKinds to send, u8. Reply: number of changes
+    /// coalesced by the rate limit so far, u32
+    FRAME_EVENTS = 0x15,
+    /// The Open button: end the auto-lock warning and put it off.
+    /// Reply: nothing
+    FRAME_POSTPONE = 0x16,
+    /// Unsolicited, sequence numbered separately from requests, payload:
+    /// EventKind u8, value u8, position i32, time of the change in ms u32
+    FRAME_EVENT = 0x40,
+};
+
+enum FrameStatusFlags : uint8_t
+{
+    FRAME_STATUS_CALIBRATED = 0x01,
+    FRAME_STATUS_DOOR_CLOSED = 0x02,
+    FRAME_STATUS_HANDLE_RAISED = 0x04,
+    FRAME_STATUS_BUSY = 0x08,
+    FRAME_STATUS_WARNING = 0x10,
+};
+
+enum FrameResult : uint8_t
+{
+    FRAME_OK = 0,
+    FRAME_BAD_CRC = 1,
+    FRAME_UNKNOWN_COMMAND = 2,
+    FRAME_BAD_LENGTH = 3,
+    FRAME_BUSY = 4,
+};
+
+struct Frame
+{
+    uint8_t command = 0;
+    uint8_t sequence = 0;
+    uint8_t length = 0;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+
+    void put_u8(uint8_t value);
+    void put_u16(uint16_t value);
+    void put_u32(uint32_t value);
+    void put_i32(int32_t value);
+
+    /// Read a value from the payload at 'offset'
+    uint32_t get_u32(size_t offset) const;
+};
+
+/// Handles a request. 'reply' has the result set to FRAME_OK; the handler
+/// appends to the payload or changes the result.
+typedef void (*frame_handler_t)(const Frame& request, Frame& reply);
+
+/// Register the handler for 'command'.
+void frame_register(uint8_t command, frame_handler_t handler);
+
+/// Read the rest of a frame whose sync byte has been read from the console
+/// UART, handle it and send the reply.
+void frame_handle();
+
+/// Send a frame on the console UART.
+void frame_send(const Frame& frame);
+
+uint16_t crc16_ccitt(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF);
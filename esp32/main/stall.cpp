@@ -0,0 +1,47 @@
+#include "stall.h"
+
+#include <algorithm>
+#include <cmath>
+
+StallDetector::StallDetector(Encoder& _encoder, int timeout_ms)
+    : encoder(_encoder),
+      timeout_us(timeout_ms * 1000LL)
+{
+}
+
+void StallDetector::start(int64_t pos, int64_t now_us)
+{
+    steps = 0;
+    last_pos = pos;
+    last_change_us = now_us;
+    cruise_speed = 0;
+}
+
+bool StallDetector::update(int64_t pos, int64_t now_us, double expected_speed)
+{
+    const double speed = fabs(encoder.get_velocity());
+    if (pos != last_pos)
+    {
+        ++steps;
+        last_pos = pos;
+        last_change_us = now_us;
+        // Running average of the speed seen at each step
+        cruise_speed = steps == 1 ? speed : cruise_speed + (speed - cruise_speed)/4;
+    }
+    if (steps < LEARN_STEPS)
+        return now_us - last_change_us > timeout_us;
+
+    // The motor may not reach the speed asked for, so never expect more than it has done
+    const double expected = expected_speed > 0 ? std::min(expected_speed, cruise_speed) : cruise_speed;
+    return speed < STALL_FRACTION * expected;
+}
+
+int64_t StallDetector::get_stall_position() const
+{
+    return last_pos;
+}
+
+double StallDetector::get_cruise_speed() const
+{
+    return cruise_speed;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "encoder.h"
+
+#include <cstdint>
+
+/// Detects that the motor has stalled, e.g. against an end stop, as soon as
+/// the measured speed falls below a fraction of the speed it has been
+/// running at, instead of waiting for a fixed time without rotation.
+class StallDetector
+{
+public:
+    /// Stalled when the speed is below this fraction of the expected speed.
+    /// Since the speed estimate decays as 1/t, this triggers about two pulse
+    /// periods after the last step.
+    static constexpr double STALL_FRACTION = 0.5;
+
+    /// Steps needed to learn the cruise speed. Until then, the no-rotation
+    /// timeout is used.
+    static constexpr int LEARN_STEPS = 3;
+
+    StallDetector(Encoder& encoder, int timeout_ms);
+
+    /// Start watching. Call once the mechanism has engaged.
+    void start(int64_t pos, int64_t now_us);
+
+    /// Return true if the motor has stalled. 'expected_speed' (pulses/s) is
+    /// what the motor is being driven at, or 0 to use the learned cruise speed.
+    bool update(int64_t pos, int64_t now_us, double expected_speed = 0);
+
+    /// Position of the last step before the stall
+    int64_t get_stall_position() const;
+
+    /// Learned cruise speed (pulses/s)
+    double get_cruise_speed() const;
+
+private:
+    Encoder& encoder;
+    int64_t timeout_us = 0;
+    int steps = 0;
+    int64_t last_pos = 0;
+    int64_t last_change_us = 0;
+    double cruise_speed = 0;
+};
@@ -0,0 +1,22 @@
+#include "status.h"
+
+void StatusPublisher::publish(const StatusSnapshot& new_snapshot)
+{
+    const auto seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshot = new_snapshot;
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+StatusSnapshot StatusPublisher::read() const
+{
+    while (true)
+    {
+        const auto seq = sequence.load(std::memory_order_acquire);
+        const StatusSnapshot copy = snapshot;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && seq == sequence.load(std::memory_order_relaxed))
+            return copy;
+    }
+}
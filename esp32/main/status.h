@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+enum State {
+    // Initial state until calibration
+    Unknown,
+    // The 'lock' command was successful
+    Locked,
+    // The 'unlock' command was successful
+    Unlocked,
+    // The position was changed manually to be neither 'locked' nor 'unlocked'
+    ChangedManually,
+    // The position was changed manually to be 'locked'
+    LockedManually,
+    // The position was changed manually to be 'unlocked'
+    UnlockedManually
+};
+
+/// Everything the 'status' command reports
+struct StatusSnapshot
+{
+    State state = Unknown;
+    bool is_calibrated = false;
+    bool door_closed = false;
+    bool handle_raised = false;
+    /// Unlocked for too long, see AutoLock
+    bool warning = false;
+    int32_t position = 0;
+    /// esp_timer_get_time() when published
+    int64_t time_us = 0;
+};
+
+/// Holds the latest StatusSnapshot, published by the motion task and read
+/// by anyone without locking or touching the hardware.
+class StatusPublisher
+{
+public:
+    /// Only one task may publish.
+    void publish(const StatusSnapshot& snapshot);
+
+    StatusSnapshot read() const;
+
+private:
+    StatusSnapshot snapshot;
+    /// Odd while a snapshot is being written
+    std::atomic<uint32_t> sequence{0};
+};
+
+extern StatusPublisher status_publisher;
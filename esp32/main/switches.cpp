@@ -3,44 +3,89 @@
 
 #include "driver/gpio.h"
 
-constexpr int NOF_READS = 5;
+/// Time a switch must be stable before a change is accepted
+constexpr int DEBOUNCE_US = 20000;
 
 Switches::Switches()
 {
     gpio_config_t io_conf;
-    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.intr_type = GPIO_INTR_ANYEDGE;
     io_conf.mode = GPIO_MODE_INPUT;
     // bit mask of the pins that you want to set
     io_conf.pin_bit_mask = (1ULL << DOOR_SW) | (1ULL << HANDLE_SW);
     io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
     io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
     ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+    const auto err = gpio_install_isr_service(0);
+    if (err != ESP_ERR_INVALID_STATE) // already installed
+        ESP_ERROR_CHECK(err);
+    init_input(m_door, DOOR_SW, "door_sw");
+    init_input(m_handle, HANDLE_SW, "handle_sw");
 }
 
-bool Switches::is_door_closed() const
+void Switches::init_input(Input& input, gpio_num_t pin, const char* name)
 {
-    for (int i = 0; i < NOF_READS; ++i)
-    {
-        if (gpio_get_level(DOOR_SW))
-            return false;
-        vTaskDelay(10 / portTICK_PERIOD_MS);
-    }
-    return true;
+    input.pin = pin;
+    input.owner = this;
+    input.active.store(!gpio_get_level(pin));
+    input.change_time_us.store(esp_timer_get_time());
+
+    esp_timer_create_args_t args = {};
+    args.callback = &debounce_timeout;
+    args.arg = &input;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = name;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &input.timer));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(pin, &edge_isr, &input));
 }
 
-bool Switches::is_handle_raised() const
+void IRAM_ATTR Switches::edge_isr(void* arg)
+{
+    auto input = (Input*) arg;
+    // Ignore further bounces until the timer has sampled the level
+    gpio_intr_disable(input->pin);
+    esp_timer_start_once(input->timer, DEBOUNCE_US);
+}
+
+void Switches::debounce_timeout(void* arg)
 {
-    for (int i = 0; i < NOF_READS; ++i)
+    auto input = (Input*) arg;
+    const bool active = !gpio_get_level(input->pin);
+    if (active != input->active.load())
     {
-        if (gpio_get_level(HANDLE_SW))
+        input->change_time_us.store(esp_timer_get_time());
+        input->active.store(active);
+        if (input == &input->owner->m_door && !active)
         {
-            verbose_printf("raised: no (%d)\n", i);
-            return false;
+            // Remember that the door was opened
+            input->owner->m_door_locked.store(false);
         }
-        vTaskDelay(10 / portTICK_PERIOD_MS);
     }
-    verbose_printf("raised: yes\n");
-    return true;
+    gpio_intr_enable(input->pin);
+    // An edge while the interrupt was disabled would otherwise be lost
+    if (!gpio_get_level(input->pin) != active)
+        edge_isr(input);
+}
+
+bool Switches::is_door_closed() const
+{
+    return m_door.active.load();
+}
+
+bool Switches::is_handle_raised() const
+{
+    return m_handle.active.load();
+}
+
+int64_t Switches::get_door_change_time_us() const
+{
+    return m_door.change_time_us.load();
+}
+
+int64_t Switches::get_handle_change_time_us() const
+{
+    return m_handle.change_time_us.load();
 }
 
 void Switches::set_door_locked()
@@ -62,13 +107,3 @@ void Switches::update()
         return;
     }
 }
-
-extern "C" void switch_task(void*)
-{
-    while (1)
-    {
-        led.update();
-        switches.update();
-        vTaskDelay(1 / portTICK_PERIOD_MS);
-    }
-}
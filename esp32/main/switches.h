@@ -1,20 +1,32 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+
+#include <driver/gpio.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
 
 class Switches
 {
 public:
-    /// Configure switch GPIO pins
+    /// Configure switch GPIO pins and start watching them for changes
     Switches();
 
-    /// Must be called often in order to not miss any state changes
+    /// Latch the door-open flag from the current state. Door openings are
+    /// also latched by the debounce timer, so this need not be called often.
     void update();
     
     bool is_door_closed() const;
 
     bool is_handle_raised() const;
 
+    /// Time (esp_timer_get_time()) of the last debounced door change.
+    int64_t get_door_change_time_us() const;
+
+    /// Time (esp_timer_get_time()) of the last debounced handle change.
+    int64_t get_handle_change_time_us() const;
+
     /// Called when the door is locked.
     void set_door_locked();
 
@@ -22,7 +34,27 @@ public:
     bool was_door_open() const;
 
 private:
-    std::atomic<bool> m_handle_raised{false};
+    /// A switch input debounced by a GPIO edge interrupt and a one-shot timer.
+    /// The interrupt is disabled while the timer runs; when it expires the
+    /// level is published and the interrupt re-enabled.
+    struct Input
+    {
+        gpio_num_t pin = (gpio_num_t) 0;
+        Switches* owner = nullptr;
+        esp_timer_handle_t timer = nullptr;
+        /// Debounced state: true if the switch is active (input pulled low)
+        std::atomic<bool> active{false};
+        std::atomic<int64_t> change_time_us{0};
+    };
+
+    void init_input(Input& input, gpio_num_t pin, const char* name);
+
+    static void IRAM_ATTR edge_isr(void* arg);
+
+    static void debounce_timeout(void* arg);
+
+    Input m_door;
+    Input m_handle;
     std::atomic<bool> m_door_locked{false};
 };
 